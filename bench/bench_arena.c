@@ -0,0 +1,79 @@
+#include "../src/arena.h"
+#include "../src/benchmark.h"
+#include "../src/go.h"
+#include "../src/types.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define THREADS 16
+#define ROUNDS 100  // scopes per task
+#define OBJECTS 64  // small allocations per scope
+
+static benchmark_results_t recorded;
+
+// 16 to 256 byte objects, the mix a task building small temporary structures produces
+static u64 object_size(u32 i) { return 16u << (i % 5); }
+
+static void touch(u8 *p, u64 size) {
+    p[0] = (u8)size;
+    p[size - 1] = (u8)size;
+}
+
+static void churn_malloc(void) {
+    u8 *objects[OBJECTS];
+    for (u32 r = 0; r < ROUNDS; r++) {
+        for (u32 i = 0; i < OBJECTS; i++) {
+            objects[i] = malloc(object_size(i));
+            assert(objects[i]);
+            touch(objects[i], object_size(i));
+        }
+        for (u32 i = 0; i < OBJECTS; i++) {
+            free(objects[i]);
+        }
+    }
+}
+
+static void churn_arena(void) {
+    arena_t *a = arena_local();
+    for (u32 r = 0; r < ROUNDS; r++) {
+        arena_scope(a);
+        for (u32 i = 0; i < OBJECTS; i++) {
+            touch(arena_alloc(a, object_size(i)), object_size(i));
+        }
+    }
+}
+
+static void bench_churn(benchmark_opts_t opts, u32 workers) {
+    go_shutdown();
+    go_init(workers);
+    benchmark_result_t r = benchmark_stats("", opts, {
+        for (u32 t = 0; t < workers; t++) {
+            spawn(churn_malloc);
+        }
+        wait();
+    });
+    benchmark_scale(&r, (f64)workers * ROUNDS * OBJECTS);
+    benchmark_record(&recorded, r, "malloc/small_churn/threads=%u", workers);
+
+    r = benchmark_stats("", opts, {
+        for (u32 t = 0; t < workers; t++) {
+            spawn(churn_arena);
+        }
+        wait();
+    });
+    benchmark_scale(&r, (f64)workers * ROUNDS * OBJECTS);
+    benchmark_record(&recorded, r, "arena/small_churn/threads=%u", workers);
+}
+
+i32 main(i32 argc, char **argv) {
+    benchmark_cli_t cli = benchmark_parse_args(argc, argv);
+    benchmark_opts_t opts = benchmark_cli_opts(&cli);
+
+    bench_churn(opts, 1);
+    bench_churn(opts, THREADS);
+    go_shutdown();
+
+    return benchmark_report(&cli, recorded.results, recorded.count);
+}
@@ -0,0 +1,67 @@
+#include "../src/benchmark.h"
+#include "../src/clock.h"
+#include "../src/go.h"
+#include "../src/types.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PROBES 200
+
+static benchmark_results_t recorded;
+
+static f64 latencies[PROBES];
+
+static f64 process_cpu_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (f64)ts.tv_sec + (f64)ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    u64 spawned_ns;
+    u32 index;
+} probe_env_t;
+
+static void probe(void *arg) {
+    probe_env_t *env = arg;
+    latencies[env->index] = (f64)(clock_ns() - env->spawned_ns) / 1e9;
+}
+
+// spawn to start latency of a goroutine arriving at an idle pool every `gap_us`, and the cpu time the whole
+// process spends per probe meanwhile. the probes themselves are empty, so the cpu is almost all idle spinning
+static void bench_idle(u64 spin_ns, const char *label, u32 gap_us) {
+    go_shutdown();
+    go_init_config(&(go_config_t){.spin_ns = spin_ns});
+    f64 cpu_before = process_cpu_seconds();
+    for (u32 i = 0; i < PROBES; i++) {
+        go_env(probe, (probe_env_t){.spawned_ns = clock_ns(), .index = i});
+        usleep(gap_us);
+    }
+    wait();
+    f64 cpu = (process_cpu_seconds() - cpu_before) / PROBES;
+
+    benchmark_result_t r = benchmark_summarize("", latencies, PROBES, 1);
+    r.p99 = benchmark_percentile(latencies, PROBES, 99.0);
+    r.max = latencies[PROBES - 1];
+    benchmark_record(&recorded, r, "idle/%s/gap=%uus/latency", label, gap_us);
+    benchmark_record(&recorded, benchmark_summarize("", &cpu, 1, 1), "idle/%s/gap=%uus/cpu", label, gap_us);
+}
+
+i32 main(i32 argc, char **argv) {
+    benchmark_cli_t cli = benchmark_parse_args(argc, argv);
+    (void)benchmark_cli_opts(&cli);
+
+    static const u32 gaps_us[] = {20, 200, 2000};
+    for (u32 i = 0; i < sizeof(gaps_us) / sizeof(gaps_us[0]); i++) {
+        bench_idle(GO_SPIN_OFF, "park", gaps_us[i]);
+        bench_idle(10 * 1000, "spin=10us", gaps_us[i]);
+        bench_idle(1000 * 1000, "spin=1ms", gaps_us[i]);
+        bench_idle(0, "adaptive", gaps_us[i]);
+    }
+    go_shutdown();
+
+    return benchmark_report(&cli, recorded.results, recorded.count);
+}
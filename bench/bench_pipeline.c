@@ -0,0 +1,284 @@
+#include "../src/benchmark.h"
+#include "../src/go.h"
+#include "../src/pipeline.h"
+#include "../src/types.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// read -> decompress -> parse -> aggregate over run length encoded csv files in a temp directory
+#define FILES 64
+#define RECORDS 32768 // "kk,vvvvvv\n" lines per file
+#define RECORD_SIZE 10
+#define TEXT_SIZE (RECORDS * RECORD_SIZE)
+#define PACKED_MAX (sizeof(u64) + 2 * TEXT_SIZE)
+#define KEYS 16
+
+static benchmark_results_t recorded;
+
+static char dir[] = "/tmp/sheaf_pipeline_XXXXXX";
+static char paths[FILES][64];
+
+// one file on its way through the stages, recycled so the runs measure the stages and not the allocator
+typedef struct chunk {
+    struct chunk *next; // free list
+    u8 *packed;
+    u64 packed_size;
+    char *text;
+    u64 text_size;
+    u64 sums[KEYS];
+} chunk_t;
+
+static chunk_t *free_chunks = NULL;
+static pthread_mutex_t chunks_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static u32 next_file = 0;
+static u64 totals[KEYS];
+static u64 expected[KEYS];
+
+//
+// files
+//
+
+// the raw size, then (run length, byte) pairs
+static u64 rle_encode(const char *text, u64 size, u8 *out) {
+    memcpy(out, &size, sizeof(size));
+    u64 n = sizeof(size);
+    for (u64 i = 0; i < size;) {
+        u64 run = 1;
+        while (i + run < size && run < 255 && text[i + run] == text[i]) {
+            run++;
+        }
+        out[n++] = (u8)run;
+        out[n++] = (u8)text[i];
+        i += run;
+    }
+    return n;
+}
+
+static void write_files(void) {
+    char *created = mkdtemp(dir);
+    assert(created);
+    char *text = malloc(TEXT_SIZE + 1);
+    u8 *packed = malloc(PACKED_MAX);
+    assert(text && packed);
+    srand(42);
+    for (u32 f = 0; f < FILES; f++) {
+        for (u32 r = 0; r < RECORDS; r++) {
+            u32 key = (u32)rand() % KEYS;
+            u32 value = (u32)rand() % 1000; // leading zeros give the encoder some runs
+            snprintf(text + r * RECORD_SIZE, RECORD_SIZE + 1, "%02u,%06u\n", key, value);
+            expected[key] += value;
+        }
+        u64 size = rle_encode(text, TEXT_SIZE, packed);
+        snprintf(paths[f], sizeof(paths[f]), "%s/%03u.rle", dir, f);
+        FILE *out = fopen(paths[f], "wb");
+        assert(out);
+        u64 written = fwrite(packed, 1, size, out);
+        assert(written == size);
+        fclose(out);
+    }
+    free(text);
+    free(packed);
+}
+
+static chunk_t *take_chunk(void) {
+    pthread_mutex_lock(&chunks_mutex);
+    chunk_t *c = free_chunks;
+    if (c) {
+        free_chunks = c->next;
+    }
+    pthread_mutex_unlock(&chunks_mutex);
+    if (!c) {
+        c = malloc(sizeof(chunk_t));
+        assert(c);
+        c->packed = malloc(PACKED_MAX);
+        c->text = malloc(TEXT_SIZE);
+        assert(c->packed && c->text);
+    }
+    memset(c->sums, 0, sizeof(c->sums));
+    return c;
+}
+
+static void give_chunk(chunk_t *c) {
+    pthread_mutex_lock(&chunks_mutex);
+    c->next = free_chunks;
+    free_chunks = c;
+    pthread_mutex_unlock(&chunks_mutex);
+}
+
+static void remove_files(void) {
+    for (u32 f = 0; f < FILES; f++) {
+        unlink(paths[f]);
+    }
+    rmdir(dir);
+    while (free_chunks) {
+        chunk_t *c = free_chunks;
+        free_chunks = c->next;
+        free(c->packed);
+        free(c->text);
+        free(c);
+    }
+}
+
+//
+// stages
+//
+
+static void *read_file(void *item, void *env) {
+    (void)item;
+    (void)env;
+    if (next_file == FILES) {
+        return NULL;
+    }
+    chunk_t *c = take_chunk();
+    i32 fd = open(paths[next_file++], O_RDONLY);
+    struct stat st;
+    assert(fd >= 0);
+    i32 result = fstat(fd, &st);
+    assert(result == 0);
+    c->packed_size = (u64)st.st_size;
+    assert(c->packed_size <= PACKED_MAX);
+    i64 got = read(fd, c->packed, c->packed_size);
+    assert(got == (i64)c->packed_size);
+    close(fd);
+    return c;
+}
+
+static void *decompress(void *item, void *env) {
+    (void)env;
+    chunk_t *c = item;
+    memcpy(&c->text_size, c->packed, sizeof(u64));
+    assert(c->text_size <= TEXT_SIZE);
+    u64 n = 0;
+    for (u64 i = sizeof(u64); i + 1 < c->packed_size; i += 2) {
+        memset(c->text + n, c->packed[i + 1], c->packed[i]);
+        n += c->packed[i];
+    }
+    assert(n == c->text_size);
+    return c;
+}
+
+static void *parse(void *item, void *env) {
+    (void)env;
+    chunk_t *c = item;
+    for (const char *line = c->text; line < c->text + c->text_size; line += RECORD_SIZE) {
+        u32 key = (u32)(line[0] - '0') * 10 + (u32)(line[1] - '0');
+        u64 value = 0;
+        for (u32 i = 3; i < RECORD_SIZE - 1; i++) {
+            value = value * 10 + (u64)(line[i] - '0');
+        }
+        c->sums[key] += value;
+    }
+    return c;
+}
+
+static void *aggregate(void *item, void *env) {
+    (void)env;
+    chunk_t *c = item;
+    for (u32 k = 0; k < KEYS; k++) {
+        totals[k] += c->sums[k];
+    }
+    give_chunk(c);
+    return NULL; // the last stage, nothing follows
+}
+
+static void check_totals(void) {
+    for (u32 k = 0; k < KEYS; k++) {
+        assert(totals[k] == expected[k]);
+    }
+}
+
+//
+// variants
+//
+
+static void bench_sequential(benchmark_opts_t opts) {
+    benchmark_result_t r = benchmark_stats("", opts, {
+        next_file = 0;
+        memset(totals, 0, sizeof(totals));
+        chunk_t *c;
+        while ((c = read_file(NULL, NULL)) != NULL) {
+            aggregate(parse(decompress(c, NULL), NULL), NULL);
+        }
+    });
+    check_totals();
+    benchmark_scale(&r, FILES);
+    benchmark_record(&recorded, r, "pipeline/sequential");
+}
+
+static void decompress_env(void *arg) { decompress(*(chunk_t **)arg, NULL); }
+
+static void parse_env(void *arg) { parse(*(chunk_t **)arg, NULL); }
+
+// what the pipeline replaces: every stage over all files, a wait() between stages and every file in memory
+static void bench_phased(benchmark_opts_t opts, u32 workers) {
+    go_shutdown();
+    go_init(workers);
+    static chunk_t *chunks[FILES];
+    benchmark_result_t r = benchmark_stats("", opts, {
+        next_file = 0;
+        memset(totals, 0, sizeof(totals));
+        for (u32 f = 0; f < FILES; f++) {
+            chunks[f] = read_file(NULL, NULL);
+        }
+        for (u32 f = 0; f < FILES; f++) {
+            go_env(decompress_env, chunks[f]);
+        }
+        wait();
+        for (u32 f = 0; f < FILES; f++) {
+            go_env(parse_env, chunks[f]);
+        }
+        wait();
+        for (u32 f = 0; f < FILES; f++) {
+            aggregate(chunks[f], NULL);
+        }
+    });
+    check_totals();
+    benchmark_scale(&r, FILES);
+    benchmark_record(&recorded, r, "pipeline/phased/workers=%u", workers);
+}
+
+static void bench_pipeline(benchmark_opts_t opts, u32 workers) {
+    go_shutdown();
+    go_init(workers);
+    u32 tokens = 2 * workers; // one item per worker in a parallel stage plus one queued behind it
+    pipeline_t p;
+    pipeline_init(&p, tokens);
+    pipeline_stage(&p, PIPELINE_SERIAL_IN_ORDER, read_file, NULL);
+    pipeline_stage(&p, PIPELINE_PARALLEL, decompress, NULL);
+    pipeline_stage(&p, PIPELINE_PARALLEL, parse, NULL);
+    pipeline_stage(&p, PIPELINE_SERIAL_OUT_OF_ORDER, aggregate, NULL);
+    benchmark_result_t r = benchmark_stats("", opts, {
+        next_file = 0;
+        memset(totals, 0, sizeof(totals));
+        pipeline_run(&p);
+    });
+    check_totals();
+    pipeline_destroy(&p);
+    benchmark_scale(&r, FILES);
+    benchmark_record(&recorded, r, "pipeline/tokens=%u/workers=%u", tokens, workers);
+}
+
+i32 main(i32 argc, char **argv) {
+    benchmark_cli_t cli = benchmark_parse_args(argc, argv);
+    benchmark_opts_t opts = benchmark_cli_opts(&cli);
+
+    write_files();
+    bench_sequential(opts);
+    u32 cpus = (u32)sysconf(_SC_NPROCESSORS_ONLN);
+    for (u32 workers = 1; workers <= cpus && workers <= GO_MAX_WORKERS; workers *= 2) {
+        bench_pipeline(opts, workers);
+    }
+    bench_phased(opts, cpus < GO_MAX_WORKERS ? cpus : GO_MAX_WORKERS);
+    go_shutdown();
+    remove_files();
+
+    return benchmark_report(&cli, recorded.results, recorded.count);
+}
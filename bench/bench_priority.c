@@ -0,0 +1,67 @@
+#include "../src/benchmark.h"
+#include "../src/clock.h"
+#include "../src/go.h"
+#include "../src/types.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define PROBES 200
+#define PROBE_INTERVAL_US 200
+#define BURST_TASK_NS 20000 // one background task
+#define BURST_PER_WORKER 15 // 300us of background work per worker every 200us, the backlog only grows
+
+static benchmark_results_t recorded;
+
+static f64 latencies[PROBES];
+
+static void background_work(void) {
+    u64 end = clock_ns() + BURST_TASK_NS;
+    while (clock_ns() < end) {
+    }
+}
+
+typedef struct {
+    u64 spawned_ns;
+    u32 index;
+} probe_env_t;
+
+static void probe(void *arg) {
+    probe_env_t *env = arg;
+    latencies[env->index] = (f64)(clock_ns() - env->spawned_ns) / 1e9;
+}
+
+// spawn to start latency of probes at `priority`. when saturated every probe is followed by a burst of
+// background work, more than the workers get through before the next probe
+static void bench_probes(go_priority_t priority, bool saturated, const char *label) {
+    u32 workers = go_worker_count();
+    for (u32 i = 0; i < PROBES; i++) {
+        go_env_priority(priority, probe, (probe_env_t){.spawned_ns = clock_ns(), .index = i});
+        for (u32 b = 0; saturated && b < BURST_PER_WORKER * workers; b++) {
+            spawn_priority(GO_PRIORITY_BACKGROUND, background_work);
+        }
+        usleep(PROBE_INTERVAL_US);
+    }
+    wait();
+
+    benchmark_result_t r = benchmark_summarize("", latencies, PROBES, 1);
+    // the tail is the point here, so p99 and max are taken over all probes instead of the outlier filtered set
+    r.p99 = benchmark_percentile(latencies, PROBES, 99.0);
+    r.max = latencies[PROBES - 1];
+    benchmark_record(&recorded, r, "latency/%s/workers=%u", label, workers);
+}
+
+i32 main(i32 argc, char **argv) {
+    benchmark_cli_t cli = benchmark_parse_args(argc, argv);
+    (void)benchmark_cli_opts(&cli);
+
+    go_init(0);
+    bench_probes(GO_PRIORITY_HIGH, false, "idle/high");
+    bench_probes(GO_PRIORITY_HIGH, true, "saturated/high");
+    bench_probes(GO_PRIORITY_NORMAL, true, "saturated/normal");
+    bench_probes(GO_PRIORITY_BACKGROUND, true, "saturated/same_as_backlog");
+    go_shutdown();
+
+    return benchmark_report(&cli, recorded.results, recorded.count);
+}
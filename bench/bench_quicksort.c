@@ -0,0 +1,124 @@
+#include "../src/benchmark.h"
+#include "../src/go.h"
+#include "../src/types.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ELEMENTS (1u << 20)
+#define CUTOFF 4096 // below this a partition is sorted sequentially
+
+static benchmark_results_t recorded;
+
+static u32 input[ELEMENTS];
+static u32 data[ELEMENTS];
+
+static i32 compare(const void *a, const void *b) {
+    u32 x = *(const u32 *)a;
+    u32 y = *(const u32 *)b;
+    return (x > y) - (x < y);
+}
+
+static void swap(u32 *a, u32 *b) {
+    u32 t = *a;
+    *a = *b;
+    *b = t;
+}
+
+// hoare partition around the median of three, returns the size of the left part
+static u64 partition(u32 *a, u64 n) {
+    u64 mid = n / 2;
+    if (a[mid] < a[0]) {
+        swap(&a[mid], &a[0]);
+    }
+    if (a[n - 1] < a[0]) {
+        swap(&a[n - 1], &a[0]);
+    }
+    if (a[n - 1] < a[mid]) {
+        swap(&a[n - 1], &a[mid]);
+    }
+    u32 pivot = a[mid];
+    u64 i = 0, j = n - 1;
+    while (true) {
+        while (a[i] < pivot) {
+            i++;
+        }
+        while (a[j] > pivot) {
+            j--;
+        }
+        if (i >= j) {
+            return j + 1;
+        }
+        swap(&a[i++], &a[j--]);
+    }
+}
+
+typedef struct {
+    u32 *a;
+    u64 n;
+} range_t;
+
+// the left half is offered to other workers, the right half is sorted in place, then the join runs
+// whatever nobody stole. recursion depth creates tasks, never threads
+static void sort_parallel(void *arg) {
+    range_t r = *(range_t *)arg;
+    if (r.n > CUTOFF) {
+        u64 left = partition(r.a, r.n);
+        task_group_t tg = TASK_GROUP_INIT;
+        task_group_go_env(&tg, sort_parallel, (range_t){.a = r.a, .n = left});
+        range_t right = {.a = r.a + left, .n = r.n - left};
+        sort_parallel(&right);
+        task_group_wait(&tg);
+        return;
+    }
+    qsort(r.a, r.n, sizeof(u32), compare);
+}
+
+static void check_sorted(void) {
+    for (u64 i = 1; i < ELEMENTS; i++) {
+        assert(data[i - 1] <= data[i]);
+    }
+}
+
+static void bench_parallel(benchmark_opts_t opts, u32 workers) {
+    go_shutdown();
+    go_init(workers);
+    benchmark_result_t r = benchmark_stats("", opts, {
+        memcpy(data, input, sizeof(data));
+        task_group_t tg = TASK_GROUP_INIT;
+        task_group_go_env(&tg, sort_parallel, (range_t){.a = data, .n = ELEMENTS});
+        task_group_wait(&tg);
+    });
+    check_sorted();
+    benchmark_scale(&r, ELEMENTS);
+    benchmark_record(&recorded, r, "quicksort/task_group/workers=%u", workers);
+}
+
+i32 main(i32 argc, char **argv) {
+    benchmark_cli_t cli = benchmark_parse_args(argc, argv);
+    benchmark_opts_t opts = benchmark_cli_opts(&cli);
+
+    srand(42);
+    for (u64 i = 0; i < ELEMENTS; i++) {
+        input[i] = (u32)rand();
+    }
+
+    benchmark_result_t r = benchmark_stats("", opts, {
+        memcpy(data, input, sizeof(data));
+        qsort(data, ELEMENTS, sizeof(u32), compare);
+    });
+    check_sorted();
+    benchmark_scale(&r, ELEMENTS);
+    benchmark_record(&recorded, r, "quicksort/qsort");
+
+    u32 cpus = (u32)sysconf(_SC_NPROCESSORS_ONLN);
+    for (u32 workers = 1; workers <= cpus && workers <= GO_MAX_WORKERS; workers *= 2) {
+        bench_parallel(opts, workers);
+    }
+    go_shutdown();
+
+    return benchmark_report(&cli, recorded.results, recorded.count);
+}
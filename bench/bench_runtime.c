@@ -0,0 +1,136 @@
+#include "../src/async.h"
+#include "../src/benchmark.h"
+#include "../src/clock.h"
+#include "../src/go.h"
+#include "../src/types.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define YIELDS_PER_RUN 1000
+#define TASKS_PER_RUN 1000
+#define NESTED_FANOUT 32
+
+static benchmark_results_t recorded;
+
+static _Atomic u64 finished_at_ns = 0;
+
+static void empty(void) {}
+
+static void empty_env(void *arg) { (void)arg; }
+
+static void *empty_pthread(void *arg) { return arg; }
+
+static void yield_loop(void) {
+    for (u32 i = 0; i < YIELDS_PER_RUN; i++) {
+        async_yield();
+    }
+}
+
+static void stamp_finish(void) { atomic_store(&finished_at_ns, clock_ns()); }
+
+static void bench_spawn_join(benchmark_opts_t opts) {
+    go_init(0);
+    benchmark_record(&recorded, benchmark_stats("", opts, {
+               spawn(empty);
+               wait();
+           }),
+           "go/spawn_join");
+}
+
+static void bench_pthread_baseline(benchmark_opts_t opts) {
+    benchmark_record(&recorded, benchmark_stats("", opts, {
+               pthread_t thread;
+               pthread_create(&thread, NULL, empty_pthread, NULL);
+               pthread_join(thread, NULL);
+           }),
+           "pthread/create_join");
+}
+
+static void bench_async_yield(benchmark_opts_t opts) {
+    // two coroutines ping-ponging, so every yield is a real switch
+    benchmark_result_t r = benchmark_stats("", opts, {
+        async_spawn(yield_loop);
+        async_spawn(yield_loop);
+        async_run_all();
+    });
+    benchmark_scale(&r, 2.0 * YIELDS_PER_RUN);
+    benchmark_record(&recorded, r, "async/yield_switch");
+}
+
+// from the last goroutine finishing to wait() returning
+static void bench_wait_wakeup(benchmark_opts_t opts) {
+    go_init(0);
+    u32 runs = opts.target_seconds < 0.5 ? 200 : 2000;
+    f64 *samples = malloc(runs * sizeof(f64));
+    assert(samples);
+    for (u32 i = 0; i < runs; i++) {
+        spawn(stamp_finish);
+        wait();
+        u64 woke = clock_ns();
+        samples[i] = (f64)(woke - atomic_load(&finished_at_ns)) / 1e9;
+    }
+    benchmark_record(&recorded, benchmark_summarize("", samples, runs, 1), "go/wait_wakeup");
+    free(samples);
+}
+
+static void bench_empty_throughput(benchmark_opts_t opts) {
+    i64 online = sysconf(_SC_NPROCESSORS_ONLN);
+    u32 max_workers = online > 0 ? (u32)online : 1;
+    for (u32 workers = 1;; workers = workers * 2 < max_workers ? workers * 2 : max_workers) {
+        go_shutdown();
+        go_init(workers);
+        benchmark_result_t r = benchmark_stats("", opts, {
+            for (u32 i = 0; i < TASKS_PER_RUN; i++) {
+                spawn(empty);
+            }
+            wait();
+        });
+        benchmark_scale(&r, TASKS_PER_RUN);
+        benchmark_record(&recorded, r, "go/empty_task/workers=%u", workers);
+        r = benchmark_stats("", opts, {
+            spawn_batch(empty_env, NULL, 0, TASKS_PER_RUN);
+            wait();
+        });
+        benchmark_scale(&r, TASKS_PER_RUN);
+        benchmark_record(&recorded, r, "go/empty_task_batch/workers=%u", workers);
+        if (workers == max_workers) {
+            break;
+        }
+    }
+    go_shutdown();
+}
+
+static void bench_nested_spawn(benchmark_opts_t opts) {
+    go_init(0);
+    benchmark_result_t r = benchmark_stats("", opts, {
+        for (u32 i = 0; i < NESTED_FANOUT; i++) {
+            go({
+                for (u32 j = 0; j < NESTED_FANOUT; j++) {
+                    spawn(empty);
+                }
+            });
+        }
+        wait();
+    });
+    benchmark_scale(&r, NESTED_FANOUT * (NESTED_FANOUT + 1));
+    benchmark_record(&recorded, r, "go/nested_spawn");
+}
+
+i32 main(i32 argc, char **argv) {
+    benchmark_cli_t cli = benchmark_parse_args(argc, argv);
+    benchmark_opts_t opts = benchmark_cli_opts(&cli);
+
+    bench_spawn_join(opts);
+    bench_pthread_baseline(opts);
+    bench_async_yield(opts);
+    bench_wait_wakeup(opts);
+    bench_empty_throughput(opts);
+    bench_nested_spawn(opts);
+
+    return benchmark_report(&cli, recorded.results, recorded.count);
+}
@@ -0,0 +1,63 @@
+#include "../src/benchmark.h"
+#include "../src/clock.h"
+#include "../src/go.h"
+#include "../src/types.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TIMERS 100000
+#define SPREAD_NS (500 * 1000 * 1000ul) // due times spread uniformly over this window
+
+static benchmark_results_t recorded;
+
+static u64 due[TIMERS];
+static u64 started[TIMERS];
+static _Atomic u32 next_start = 0;
+static f64 lateness[TIMERS];
+
+static void on_time(void) { started[atomic_fetch_add(&next_start, 1)] = clock_ns(); }
+
+static i32 compare_u64(const void *a, const void *b) {
+    u64 x = *(const u64 *)a;
+    u64 y = *(const u64 *)b;
+    return (x > y) - (x < y);
+}
+
+// due time to start of the goroutine. timers fire in due order, so once both sides are sorted the k-th
+// start belongs to the k-th due time, no per timer state has to travel with the goroutine
+static void bench_lateness(u32 n) {
+    atomic_store(&next_start, 0);
+    srand(42);
+    for (u32 i = 0; i < n; i++) {
+        u64 delay = (u64)rand() % (u64)SPREAD_NS;
+        due[i] = clock_ns() + delay;
+        spawn_after(delay, on_time);
+    }
+    wait();
+    assert(atomic_load(&next_start) == n);
+
+    qsort(due, n, sizeof(u64), compare_u64);
+    qsort(started, n, sizeof(u64), compare_u64);
+    for (u32 i = 0; i < n; i++) {
+        lateness[i] = started[i] > due[i] ? (f64)(started[i] - due[i]) / 1e9 : 0.0;
+    }
+    benchmark_result_t r = benchmark_summarize("", lateness, n, 1);
+    // jitter lives in the tail, so p99 and max cover every timer
+    r.p99 = benchmark_percentile(lateness, n, 99.0);
+    r.max = lateness[n - 1];
+    benchmark_record(&recorded, r, "timer/lateness/timers=%u", n);
+}
+
+i32 main(i32 argc, char **argv) {
+    benchmark_cli_t cli = benchmark_parse_args(argc, argv);
+    (void)benchmark_cli_opts(&cli);
+
+    go_init(0);
+    bench_lateness(1000);
+    bench_lateness(TIMERS);
+    go_shutdown();
+
+    return benchmark_report(&cli, recorded.results, recorded.count);
+}
@@ -0,0 +1,93 @@
+#include "arena.h"
+#include "types.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+static __thread arena_t thread_arena;
+static __thread bool thread_arena_ready = false;
+static __thread arena_t *local_override = NULL;
+
+static pthread_key_t release_key;
+static pthread_once_t release_once = PTHREAD_ONCE_INIT;
+
+void arena_init(arena_t *a, u64 block_size) {
+    assert(a);
+    a->head = NULL;
+    a->spare = NULL;
+    a->block_size = block_size ? block_size : ARENA_BLOCK_SIZE;
+}
+
+static void free_chain(arena_block_t *b) {
+    while (b) {
+        arena_block_t *prev = b->prev;
+        free(b);
+        b = prev;
+    }
+}
+
+void arena_destroy(arena_t *a) {
+    assert(a);
+    free_chain(a->head);
+    free_chain(a->spare);
+    a->head = NULL;
+    a->spare = NULL;
+}
+
+void *arena_alloc_slow(arena_t *a, u64 size) {
+    arena_block_t *b = a->spare;
+    if (b && b->size >= size) {
+        a->spare = b->prev;
+    } else {
+        u64 capacity = size > a->block_size ? size : a->block_size;
+        b = malloc(sizeof(arena_block_t) + capacity);
+        assert(b);
+        b->size = capacity;
+    }
+    b->used = size;
+    b->prev = a->head;
+    a->head = b;
+    return b->data;
+}
+
+void arena_rewind(arena_t *a, arena_mark_t mark) {
+    while (a->head != mark.block) {
+        arena_block_t *b = a->head;
+        assert(b && "mark does not belong to this arena");
+        a->head = b->prev;
+        b->prev = a->spare;
+        a->spare = b;
+    }
+    if (a->head) {
+        a->head->used = mark.used;
+    }
+}
+
+static void release_thread_arena(void *arg) { arena_destroy((arena_t *)arg); }
+
+static void create_release_key(void) {
+    i32 result = pthread_key_create(&release_key, release_thread_arena);
+    assert(result == 0);
+}
+
+arena_t *arena_local(void) {
+    if (local_override) {
+        return local_override;
+    }
+    if (!thread_arena_ready) {
+        arena_init(&thread_arena, 0);
+        // the key's destructor hands the blocks back when the thread exits
+        pthread_once(&release_once, create_release_key);
+        i32 result = pthread_setspecific(release_key, &thread_arena);
+        assert(result == 0);
+        thread_arena_ready = true;
+    }
+    return &thread_arena;
+}
+
+arena_t *arena_swap_local(arena_t *a) {
+    arena_t *previous = local_override;
+    local_override = a;
+    return previous;
+}
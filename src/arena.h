@@ -0,0 +1,71 @@
+#pragma once
+
+#include "defer.h"
+#include "types.h"
+
+#include <stdbool.h>
+
+// bump allocator over a chain of blocks. nothing is freed individually: a scope remembers where the arena
+// was and rewinds to it on exit, which releases everything allocated inside in one step. blocks emptied
+// by a rewind are kept for reuse, so a hot loop of scopes stops calling malloc after the first iteration.
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+
+typedef struct arena_block {
+    struct arena_block *prev; // older block, allocations only ever come from the newest
+    u64 size;
+    u64 used;
+    _Alignas(ARENA_ALIGN) u8 data[];
+} arena_block_t;
+
+typedef struct {
+    arena_block_t *head;  // current block
+    arena_block_t *spare; // blocks released by rewinds, reused before calling malloc
+    u64 block_size;
+} arena_t;
+
+typedef struct {
+    arena_block_t *block;
+    u64 used;
+} arena_mark_t;
+
+// 0 for the default block size, no memory is reserved until the first allocation
+void arena_init(arena_t *a, u64 block_size);
+
+void arena_destroy(arena_t *a);
+
+// grows the arena by a block, large requests get a block of their own
+void *arena_alloc_slow(arena_t *a, u64 size);
+
+static inline void *arena_alloc(arena_t *a, u64 size) {
+    arena_block_t *b = a->head;
+    if (__builtin_expect(b != NULL, 1)) {
+        u64 offset = (b->used + ARENA_ALIGN - 1) & ~(u64)(ARENA_ALIGN - 1);
+        if (__builtin_expect(offset + size <= b->size, 1)) {
+            b->used = offset + size;
+            return b->data + offset;
+        }
+    }
+    return arena_alloc_slow(a, size);
+}
+
+static inline arena_mark_t arena_mark(const arena_t *a) { return (arena_mark_t){.block = a->head, .used = a->head ? a->head->used : 0}; }
+
+// frees everything allocated since `mark`, newer blocks move to the spare list
+void arena_rewind(arena_t *a, arena_mark_t mark);
+
+// the calling thread's arena, or the running coroutine's own arena inside async_spawn'd code, so
+// interleaved coroutines never rewind each other's allocations. go workers each get their own
+arena_t *arena_local(void);
+
+// makes `a` what arena_local returns on this thread until swapped back, NULL restores the thread's arena
+arena_t *arena_swap_local(arena_t *a);
+
+// everything allocated from `a` after this line is freed when the enclosing block exits
+// clang-format off
+#define arena_scope(a) \
+    arena_t *UNIQUE_NAME(__arena_) = (a); \
+    arena_mark_t UNIQUE_NAME(__arena_mark_) = arena_mark(UNIQUE_NAME(__arena_)); \
+    defer({ arena_rewind(UNIQUE_NAME(__arena_), UNIQUE_NAME(__arena_mark_)); })
+// clang-format on
@@ -1,38 +1,90 @@
 #define _GNU_SOURCE
+#include "arena.h"
 #include "async.h"
+#include "cancel.h"
+#include "clock.h"
 #include "go.h"
+#include "trace.h"
 #include "types.h"
 
 #include <assert.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
 #include <ucontext.h>
 #include <unistd.h>
 
 #define STACK_SIZE (2 << 15) // 64KB stack per thread
+#define STACK_GUARD 1024     // padding at each end of the stack
+#define STACK_PAINT 0xa5     // canary byte, overwritten as the stack grows
+#define POOL_MAX 64          // finished coroutines kept with their stacks for reuse
+
+#ifndef __has_feature
+#define __has_feature(x) 0
+#endif
+#if defined(__SANITIZE_ADDRESS__) || __has_feature(address_sanitizer)
+#include <sanitizer/asan_interface.h>
+#define unpoison_stack(stack, size) __asan_unpoison_memory_region(stack, size)
+#else
+#define unpoison_stack(stack, size) ((void)0)
+#endif
 
 struct async_thread {
     ucontext_t context; // cpu register, stack pointer
     u8 *stack;          // stack memory
     fn_ptr func;        // function to execute
+    env_fn_ptr env_func; // set instead of func by async_spawn_env
     async_thread_state_t state;
     u8 id;
+    arena_t arena; // what arena_local returns while this coroutine runs
+    struct async_thread *next_free;
+    const cancel_token_t *token; // current where it was spawned
+#ifdef SHEAF_TRACE
+    u64 trace_id; // unique across runs, unlike id
+#endif
+    _Alignas(16) u8 env[ASYNC_ENV_SIZE]; // captured state, copied in so closures need no trampoline
 };
 
 typedef struct async_thread uthread_t;
 
 static uthread_t *threads[UINT8_MAX + 1] = {0};
-static u8 thread_count = 0;
+static u8 thread_count = 0; // slots handed out so far, ids below it are live or free
+static u8 free_ids[UINT8_MAX + 1]; // slots of reaped coroutines, reused before new ones are taken
+static u16 free_id_count = 0;
 static u8 current_thread = 0;
+static u8 next_thread = 0; // round robin cursor, survives across async_run_once calls
 static ucontext_t main_context;
 
+static i32 poll_fd = -1;
+static bool poll_signaled = false;
+
+static u64 completed = 0; // only written by the scheduling thread, may be polled from others
+
+// finished coroutines keep their stack and arena blocks, so a steady spawn/finish cycle maps nothing
+static uthread_t *free_threads = NULL;
+static u32 free_count = 0;
+static u64 descriptors_allocated = 0;
+
+#ifdef SHEAF_STATS
+static async_stack_stats_t stack_stats = {0};
+#endif
+
 static u8 *allocate_stack(u64 size) {
-    // with execute permissions, ASan doesn't complain about stack use when context switching
-    void *stack = mmap(NULL, size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef SHEAF_EXEC_STACKS
+    // nested functions that capture locals (go, lambda) put trampolines on the stack they are defined on
+    i32 prot = PROT_READ | PROT_WRITE | PROT_EXEC;
+#else
+    i32 prot = PROT_READ | PROT_WRITE;
+#endif
+    void *stack = mmap(NULL, size, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     assert(stack != MAP_FAILED);
+#ifdef SHEAF_STATS
+    memset(stack, STACK_PAINT, size);
+#else
     memset(stack, 0, size);
+#endif
     return (u8 *)stack;
 }
 
@@ -43,95 +95,376 @@ static void free_stack(u8 *stack, u64 size) {
     munmap(stack, size);
 }
 
+static bool has_runnable(void) {
+    for (u8 i = 0; i < thread_count; i++) {
+        if (threads[i] && threads[i]->state != ASYNC_THREAD_FINISHED) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// level-triggered: the eventfd counter is non-zero exactly while there is work to run
+static void update_readiness(void) {
+    if (poll_fd < 0) {
+        return;
+    }
+    bool runnable = has_runnable();
+    if (runnable && !poll_signaled) {
+        u64 one = 1;
+        i64 n = write(poll_fd, &one, sizeof(one));
+        assert(n == (i64)sizeof(one));
+        poll_signaled = true;
+    } else if (!runnable && poll_signaled) {
+        u64 drained;
+        i64 n = read(poll_fd, &drained, sizeof(drained));
+        assert(n == (i64)sizeof(drained));
+        poll_signaled = false;
+    }
+}
+
+#ifdef SHEAF_STATS
+// stacks grow down, so the lowest overwritten canary word marks the deepest frame.
+// frames left behind by swapcontext are still poisoned, hence no asan here.
+__attribute__((no_sanitize_address)) static u32 stack_high_water(const u8 *stack) {
+    const u64 paint = 0x0101010101010101ULL * STACK_PAINT;
+    const u64 *words = (const u64 *)(const void *)(stack + STACK_GUARD);
+    const u32 count = (STACK_SIZE - 2 * STACK_GUARD) / sizeof(u64);
+    u32 untouched = 0;
+    while (untouched < count && words[untouched] == paint) {
+        untouched++;
+    }
+    return (count - untouched) * (u32)sizeof(u64);
+}
+
+static void record_stack(u8 i) {
+    u32 used = stack_high_water(threads[i]->stack);
+    u8 bucket = used ? (u8)(32 - __builtin_clz(used)) : 0;
+    assert(bucket < ASYNC_STACK_BUCKETS);
+    stack_stats.histogram[bucket]++;
+    stack_stats.samples++;
+    stack_stats.used[i] = used;
+    if (used > stack_stats.max_used) {
+        stack_stats.max_used = used;
+    }
+}
+#endif
+
+//
+// scheduler instrumentation, compiled out unless SHEAF_STATS
+//
+
+#ifdef SHEAF_STATS
+static async_sched_stats_t sched_stats = {0};
+static u64 ready_since_ns[UINT8_MAX + 1] = {0};
+static u64 window_start_ns = 0;
+static u64 idle_since_ns = 0;
+static u64 slice_start_ns = 0;
+
+static inline void stats_spawned(u8 i) {
+    u64 now = clock_ns();
+    if (window_start_ns == 0) {
+        window_start_ns = now;
+    }
+    if (idle_since_ns) {
+        sched_stats.idle_ns += now - idle_since_ns;
+        idle_since_ns = 0;
+    }
+    memset(&sched_stats.threads[i], 0, sizeof(async_thread_stats_t));
+    ready_since_ns[i] = now;
+}
+
+static inline void stats_slice_begin(u8 i) {
+    slice_start_ns = clock_ns();
+    sched_stats.threads[i].wait_ns += slice_start_ns - ready_since_ns[i];
+}
+
+static inline void stats_slice_end(u8 i) {
+    u64 now = clock_ns();
+    u64 slice = now - slice_start_ns;
+    sched_stats.threads[i].run_ns += slice;
+    sched_stats.busy_ns += slice;
+    sched_stats.switches++;
+    if (slice > sched_stats.longest_slice_ns) {
+        sched_stats.longest_slice_ns = slice;
+        sched_stats.longest_slice_id = i;
+    }
+    ready_since_ns[i] = now;
+}
+
+static inline void stats_yielded(u8 i) { sched_stats.threads[i].yields++; }
+
+static inline void stats_drained(void) {
+    if (window_start_ns && !idle_since_ns) {
+        idle_since_ns = clock_ns();
+    }
+}
+#else
+static inline void stats_spawned(u8 i) { (void)i; }
+static inline void stats_slice_begin(u8 i) { (void)i; }
+static inline void stats_slice_end(u8 i) { (void)i; }
+static inline void stats_yielded(u8 i) { (void)i; }
+static inline void stats_drained(void) {}
+#endif
+
+static void reap(u8 i) {
+#ifdef SHEAF_STATS
+    record_stack(i);
+#endif
+    uthread_t *t = threads[i];
+    threads[i] = NULL;
+    free_ids[free_id_count++] = i;
+    if (free_count < POOL_MAX) {
+        arena_rewind(&t->arena, (arena_mark_t){0});
+        t->next_free = free_threads;
+        free_threads = t;
+        free_count++;
+        return;
+    }
+    free_stack(t->stack, STACK_SIZE);
+    arena_destroy(&t->arena);
+    free(t);
+}
+
 void async_yield(void) {
     bool is_running = threads[current_thread] && threads[current_thread]->state == ASYNC_THREAD_RUNNING;
     if (!is_running) {
         return;
     }
     threads[current_thread]->state = ASYNC_THREAD_YIELDED;
+    stats_yielded(current_thread);
     swapcontext(&threads[current_thread]->context, &main_context);
 }
 
 static void invoke(void) {
     uthread_t *t = threads[current_thread];
     assert(t != NULL);
-    assert(t->func != NULL);
-    t->func(); // exec
+    assert(t->func != NULL || t->env_func != NULL);
+    if (t->env_func) {
+        t->env_func(t->env); // exec
+    } else {
+        t->func(); // exec
+    }
+    __atomic_store_n(&completed, completed + 1, __ATOMIC_RELAXED);
     t->state = ASYNC_THREAD_FINISHED;
     swapcontext(&t->context, &main_context);
 }
 
-u8 async_spawn(fn_ptr func) {
-    assert(func);
-    assert(thread_count < U8_MAX);
-
-    uthread_t *t = malloc(sizeof(uthread_t));
-    assert(t);
+static uthread_t *new_thread(void) {
+    // long lived coroutines keep the slots from being renumbered, so finished ones hand theirs on
+    assert((free_id_count > 0 || thread_count < U8_MAX) && "too many live coroutines");
 
-    t->stack = allocate_stack(STACK_SIZE);
-    t->func = func;
+    uthread_t *t = free_threads;
+    if (t) {
+        free_threads = t->next_free;
+        free_count--;
+        // frames of the previous coroutine never returned, their redzones would still be poisoned
+        unpoison_stack(t->stack, STACK_SIZE);
+#ifdef SHEAF_STATS
+        memset(t->stack, STACK_PAINT, STACK_SIZE);
+#endif
+    } else {
+        t = malloc(sizeof(uthread_t));
+        assert(t);
+        t->stack = allocate_stack(STACK_SIZE);
+        assert(t->stack);
+        arena_init(&t->arena, 0);
+        descriptors_allocated++;
+    }
+    t->func = NULL;
+    t->env_func = NULL;
     t->state = ASYNC_THREAD_READY;
-    t->id = thread_count;
-    assert(t->stack);
+    t->id = free_id_count > 0 ? free_ids[--free_id_count] : thread_count;
+    t->token = cancel_current();
+    return t;
+}
 
+static u8 start_thread(uthread_t *t) {
     memset(&t->context, 0, sizeof(ucontext_t));
     assert(getcontext(&t->context) != -1);
     // 1KB guard pages at each end of the stack to catch overflows
-    t->context.uc_stack.ss_sp = t->stack + 1024;
-    t->context.uc_stack.ss_size = STACK_SIZE - 2048;
+    t->context.uc_stack.ss_sp = t->stack + STACK_GUARD;
+    t->context.uc_stack.ss_size = STACK_SIZE - 2 * STACK_GUARD;
     // no return context
     t->context.uc_link = NULL;
     makecontext(&t->context, invoke, 0);
 
-    threads[thread_count++] = t;
+#ifdef SHEAF_TRACE
+    t->trace_id = trace_next_id();
+#endif
+    trace_event(TRACE_SPAWN, TRACE_ASYNC, t->trace_id);
+
+    threads[t->id] = t;
+    if (t->id == thread_count) {
+        thread_count++;
+    }
+    stats_spawned(t->id);
+    update_readiness();
     return t->id;
 }
 
-void async_run_all(void) {
-    if (thread_count == 0) {
-        return;
-    }
+u8 async_spawn(fn_ptr func) {
+    assert(func);
+    uthread_t *t = new_thread();
+    t->func = func;
+    return start_thread(t);
+}
 
-    // round robin scheduling
-    while (true) {
-        bool all_finished = true;
+u8 async_spawn_env(env_fn_ptr func, const void *env, u64 size) {
+    assert(func);
+    assert(size <= ASYNC_ENV_SIZE);
+    assert(env != NULL || size == 0);
+    uthread_t *t = new_thread();
+    t->env_func = func;
+    if (size > 0) {
+        memcpy(t->env, env, size);
+    }
+    return start_thread(t);
+}
 
-        for (u8 i = 0; i < thread_count; i++) {
-            // skip null slot
-            if (!threads[i]) {
-                continue;
+u32 async_run_once(u32 budget) {
+    u32 slices = 0;
+    while (slices < budget) {
+        // find the next runnable thread after the last one that ran
+        bool found = false;
+        u8 i = 0;
+        for (u16 n = 0; n < thread_count; n++) {
+            i = (u8)((next_thread + n) % thread_count);
+            if (threads[i] && (threads[i]->state == ASYNC_THREAD_READY || threads[i]->state == ASYNC_THREAD_YIELDED)) {
+                found = true;
+                break;
             }
+        }
+        if (!found) {
+            break;
+        }
 
-            // shouldn't yield control if still running
-            assert(threads[i]->state != ASYNC_THREAD_RUNNING);
+        // shouldn't yield control if still running
+        assert(threads[i]->state != ASYNC_THREAD_RUNNING);
 
-            // save this context, switch to thread's context
-            if (threads[i]->state == ASYNC_THREAD_READY || threads[i]->state == ASYNC_THREAD_YIELDED) {
-                all_finished = false;
-                current_thread = i;
-                threads[i]->state = ASYNC_THREAD_RUNNING;
-                assert(swapcontext(&main_context, &threads[i]->context) != -1);
-            }
+        // cancelled before its first slice, dropped without running
+        if (threads[i]->state == ASYNC_THREAD_READY && cancel_requested(threads[i]->token)) {
+            next_thread = (u8)(i + 1);
+            reap(i);
+            continue;
         }
 
-        if (all_finished) {
-            break;
+        // save this context, switch to thread's context
+        current_thread = i;
+        trace_event(threads[i]->state == ASYNC_THREAD_READY ? TRACE_START : TRACE_RESUME, TRACE_ASYNC, threads[i]->trace_id);
+        threads[i]->state = ASYNC_THREAD_RUNNING;
+        stats_slice_begin(i);
+        arena_t *outer = arena_swap_local(&threads[i]->arena);
+        const cancel_token_t *outer_token = cancel_swap_current(threads[i]->token);
+        assert(swapcontext(&main_context, &threads[i]->context) != -1);
+        cancel_swap_current(outer_token);
+        arena_swap_local(outer);
+        stats_slice_end(i);
+        trace_event(threads[i]->state == ASYNC_THREAD_FINISHED ? TRACE_FINISH : TRACE_YIELD, TRACE_ASYNC, threads[i]->trace_id);
+        slices++;
+        next_thread = (u8)(i + 1);
+
+        if (threads[i]->state == ASYNC_THREAD_FINISHED) {
+            reap(i);
         }
     }
 
+    // all slots free, start numbering from scratch
+    if (!has_runnable()) {
+        stats_drained();
+        async_cleanup_all();
+    }
+    update_readiness();
+    return slices;
+}
+
+i32 async_poll_fd(void) {
+    if (poll_fd < 0) {
+        poll_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        assert(poll_fd >= 0);
+        poll_signaled = false;
+        update_readiness();
+    }
+    return poll_fd;
+}
+
+void async_run_all(void) {
+    // round robin scheduling
+    while (async_run_once(U32_MAX) > 0) {
+    }
+
     async_cleanup_all();
 }
 
 void async_cleanup_all(void) {
     for (u8 i = 0; i < thread_count; i++) {
         if (threads[i]) {
-            if (threads[i]->stack) {
-                free_stack(threads[i]->stack, STACK_SIZE);
-            }
-            free(threads[i]);
-            threads[i] = NULL;
+            reap(i);
         }
     }
     thread_count = 0;
+    free_id_count = 0;
     current_thread = 0;
+    next_thread = 0;
+    update_readiness();
+}
+
+u64 async_descriptors_allocated(void) { return descriptors_allocated; }
+
+u64 async_completed(void) { return __atomic_load_n(&completed, __ATOMIC_RELAXED); }
+
+void async_stack_stats(async_stack_stats_t *out) {
+    assert(out);
+#ifdef SHEAF_STATS
+    *out = stack_stats;
+    // live coroutines are measured in place, without adding to the histogram
+    for (u8 i = 0; i < thread_count; i++) {
+        if (threads[i]) {
+            out->used[i] = stack_high_water(threads[i]->stack);
+        }
+    }
+#else
+    memset(out, 0, sizeof(*out));
+#endif
+    out->stack_size = STACK_SIZE - 2 * STACK_GUARD;
+}
+
+void async_stack_stats_reset(void) {
+#ifdef SHEAF_STATS
+    memset(&stack_stats, 0, sizeof(stack_stats));
+#endif
+}
+
+void async_sched_stats(async_sched_stats_t *out) {
+    assert(out);
+#ifdef SHEAF_STATS
+    // single threaded scheduler, a plain copy is a consistent snapshot
+    *out = sched_stats;
+    u64 now = clock_ns();
+    if (window_start_ns) {
+        out->elapsed_ns = now - window_start_ns;
+    }
+    if (idle_since_ns) {
+        out->idle_ns += now - idle_since_ns;
+    }
+    out->switches_per_sec = out->elapsed_ns ? (f64)out->switches * 1e9 / (f64)out->elapsed_ns : 0.0;
+#else
+    memset(out, 0, sizeof(*out));
+#endif
+}
+
+void async_sched_stats_reset(void) {
+#ifdef SHEAF_STATS
+    memset(&sched_stats, 0, sizeof(sched_stats));
+    window_start_ns = 0;
+    idle_since_ns = 0;
+    // coroutines that are still alive keep being timed from now on
+    u64 now = clock_ns();
+    for (u16 i = 0; i <= UINT8_MAX; i++) {
+        ready_since_ns[i] = now;
+    }
+    if (has_runnable()) {
+        window_start_ns = now;
+    }
+#endif
 }
@@ -5,11 +5,86 @@ typedef struct async_thread async_thread_t;
 
 typedef enum { ASYNC_THREAD_READY, ASYNC_THREAD_RUNNING, ASYNC_THREAD_FINISHED, ASYNC_THREAD_YIELDED } async_thread_state_t;
 
+// returns the coroutine's id. ids of finished coroutines are reused, at most 255 may be alive at once
 u8 async_spawn(fn_ptr func);
 
+#define ASYNC_ENV_SIZE 64
+
+// `env` is copied next to the coroutine's context and `func` gets a pointer to the copy. no trampoline is
+// involved, so this is the closure to use unless the stacks are built executable (`scons exec_stacks=1`)
+u8 async_spawn_env(env_fn_ptr func, const void *env, u64 size);
+
+// captures a value by copy for an ordinary function, e.g. async_env(serve, (conn_t){.fd = fd})
+// clang-format off
+#define async_env(func, ...) \
+    ({ \
+        __typeof__(__VA_ARGS__) async_env_ = __VA_ARGS__; \
+        _Static_assert(sizeof(async_env_) <= ASYNC_ENV_SIZE, "environment too large for async_env"); \
+        async_spawn_env(func, &async_env_, sizeof(async_env_)); \
+    })
+// clang-format on
+
 void async_yield(void);
 
 // event-loop like async using ucontext.h
 void async_run_all(void);
 
+// runs at most `budget` coroutine slices, then returns the number of slices run
+// (0 once there is nothing left to do) so a host event loop can drive the scheduler
+u32 async_run_once(u32 budget);
+
+// eventfd that is readable while there is runnable work, for epoll/poll based host loops
+i32 async_poll_fd(void);
+
 void async_cleanup_all(void);
+
+// coroutine descriptors (and stacks) ever allocated, up to 64 finished ones are kept for reuse
+u64 async_descriptors_allocated(void);
+
+// coroutines finished since the process started, a plain counter that other threads can poll for progress
+u64 async_completed(void);
+
+//
+// stack usage, only recorded when built with SHEAF_STATS (`scons stats=1`)
+//
+
+#define ASYNC_STACK_BUCKETS 17
+
+typedef struct {
+    u64 stack_size;                      // usable bytes per coroutine stack
+    u64 max_used;                        // deepest high-water mark seen
+    u64 samples;                         // finished coroutines measured
+    u64 histogram[ASYNC_STACK_BUCKETS];  // bucket i counts high-water marks in [2^(i-1), 2^i)
+    u32 used[UINT8_MAX + 1];             // high-water mark per coroutine id, live ones measured on the spot
+} async_stack_stats_t;
+
+// stacks are painted with a canary pattern on allocation and scanned when a coroutine is reaped
+void async_stack_stats(async_stack_stats_t *out);
+
+void async_stack_stats_reset(void);
+
+//
+// scheduler counters, only recorded when built with SHEAF_STATS (`scons stats=1`)
+//
+
+typedef struct {
+    u64 run_ns;  // time spent running
+    u64 yields;  // calls to async_yield
+    u64 wait_ns; // time spent ready but waiting for a slice (scheduling latency)
+} async_thread_stats_t;
+
+typedef struct {
+    u64 elapsed_ns;       // since the first spawn after a reset
+    u64 busy_ns;          // inside coroutine slices
+    u64 idle_ns;          // with nothing runnable
+    u64 switches;         // slices run
+    f64 switches_per_sec; // switches over elapsed_ns
+    u64 longest_slice_ns; // longest time a coroutine held the loop without yielding
+    u8 longest_slice_id;  // coroutine that held it
+    async_thread_stats_t threads[UINT8_MAX + 1]; // per coroutine id, reset when the id is reused
+} async_sched_stats_t;
+
+// lock free: copies the scheduler's own counters, call from the scheduling thread
+void async_sched_stats(async_sched_stats_t *out);
+
+void async_sched_stats_reset(void);
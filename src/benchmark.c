@@ -0,0 +1,353 @@
+#include "benchmark.h"
+#include "clock.h"
+#include "types.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const char *const counter_names[BENCHMARK_COUNTERS] = {"cycles", "instructions", "cache_misses", "branch_misses", "context_switches"};
+
+static i32 open_counter(benchmark_counter_t counter, i32 tid, i32 group_fd) {
+    static const u32 types[BENCHMARK_COUNTERS] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE};
+    static const u64 configs[BENCHMARK_COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_SW_CONTEXT_SWITCHES};
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = types[counter];
+    attr.config = configs[counter];
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // context switches happen in the kernel, only count them there if perf_event_paranoid allows it
+    if (counter == BENCHMARK_CONTEXT_SWITCHES) {
+        attr.exclude_kernel = 0;
+        i32 fd = (i32)syscall(SYS_perf_event_open, &attr, tid, -1, group_fd, 0);
+        if (fd >= 0) {
+            return fd;
+        }
+        attr.exclude_kernel = 1;
+    }
+    return (i32)syscall(SYS_perf_event_open, &attr, tid, -1, group_fd, 0);
+}
+
+void benchmark_perf_open(benchmark_perf_t *p) {
+    memset(p, 0, sizeof(*p));
+    DIR *dir = opendir("/proc/self/task");
+    if (!dir) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && p->threads < BENCHMARK_PERF_MAX_THREADS) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        i32 tid = atoi(entry->d_name);
+        i32 *fds = p->fd[p->threads++];
+        // cycles lead the group so the hardware counters are scheduled together
+        fds[BENCHMARK_CYCLES] = open_counter(BENCHMARK_CYCLES, tid, -1);
+        for (u32 c = BENCHMARK_CYCLES + 1; c < BENCHMARK_COUNTERS; c++) {
+            fds[c] = open_counter((benchmark_counter_t)c, tid, fds[BENCHMARK_CYCLES]);
+        }
+    }
+    closedir(dir);
+}
+
+void benchmark_perf_start(const benchmark_perf_t *p) {
+    for (u32 t = 0; t < p->threads; t++) {
+        for (u32 c = 0; c < BENCHMARK_COUNTERS; c++) {
+            if (p->fd[t][c] >= 0) {
+                ioctl(p->fd[t][c], PERF_EVENT_IOC_RESET, 0);
+                ioctl(p->fd[t][c], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+}
+
+benchmark_counters_t benchmark_perf_stop(const benchmark_perf_t *p) {
+    benchmark_counters_t out;
+    memset(&out, 0, sizeof(out));
+    for (u32 t = 0; t < p->threads; t++) {
+        for (u32 c = 0; c < BENCHMARK_COUNTERS; c++) {
+            if (p->fd[t][c] < 0) {
+                continue;
+            }
+            ioctl(p->fd[t][c], PERF_EVENT_IOC_DISABLE, 0);
+            u64 data[3]; // value, time enabled, time running
+            if (read(p->fd[t][c], data, sizeof(data)) != sizeof(data)) {
+                continue;
+            }
+            f64 value = (f64)data[0];
+            if (data[2] > 0 && data[2] < data[1]) {
+                value *= (f64)data[1] / (f64)data[2];
+            }
+            out.value[c] += value;
+            out.valid[c] = true;
+        }
+    }
+    return out;
+}
+
+void benchmark_perf_close(benchmark_perf_t *p) {
+    for (u32 t = 0; t < p->threads; t++) {
+        for (u32 c = 0; c < BENCHMARK_COUNTERS; c++) {
+            if (p->fd[t][c] >= 0) {
+                close(p->fd[t][c]);
+            }
+        }
+    }
+    p->threads = 0;
+}
+
+void benchmark_print_counters(const benchmark_counters_t *counters) {
+    bool any = false;
+    for (u32 c = 0; c < BENCHMARK_COUNTERS; c++) {
+        if (counters->valid[c]) {
+            printf("%s%s=%.0f", any ? " " : "    ", counter_names[c], counters->value[c]);
+            any = true;
+        }
+    }
+    if (counters->valid[BENCHMARK_CYCLES] && counters->valid[BENCHMARK_INSTRUCTIONS] && counters->value[BENCHMARK_CYCLES] > 0) {
+        printf(" ipc=%.2f", counters->value[BENCHMARK_INSTRUCTIONS] / counters->value[BENCHMARK_CYCLES]);
+    }
+    if (any) {
+        printf("\n");
+    }
+}
+
+static i32 cmp_f64(const void *a, const void *b) {
+    f64 x = *(const f64 *)a;
+    f64 y = *(const f64 *)b;
+    return (x > y) - (x < y);
+}
+
+f64 benchmark_percentile(const f64 *sorted, u32 n, f64 p) {
+    if (n == 0) {
+        return 0.0;
+    }
+    f64 position = ceil(p / 100.0 * (f64)n);
+    u32 rank = (u32)position;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+benchmark_result_t benchmark_summarize(const char *name, f64 *samples, u32 n, u64 batch) {
+    benchmark_result_t r = {.name = name, .batch = batch};
+    if (n == 0) {
+        return r;
+    }
+    qsort(samples, n, sizeof(f64), cmp_f64);
+
+    f64 q1 = benchmark_percentile(samples, n, 25.0);
+    f64 q3 = benchmark_percentile(samples, n, 75.0);
+    f64 lo = q1 - 1.5 * (q3 - q1);
+    f64 hi = q3 + 1.5 * (q3 - q1);
+    u32 first = 0;
+    u32 last = n;
+    while (first < n && samples[first] < lo) {
+        first++;
+    }
+    while (last > first && samples[last - 1] > hi) {
+        last--;
+    }
+    const f64 *kept = samples + first;
+    u32 k = last - first;
+
+    f64 sum = 0.0;
+    for (u32 i = 0; i < k; i++) {
+        sum += kept[i];
+    }
+    f64 mean = sum / (f64)k;
+    f64 var = 0.0;
+    for (u32 i = 0; i < k; i++) {
+        var += (kept[i] - mean) * (kept[i] - mean);
+    }
+
+    // order statistics already shrug off outliers and the tail is what p99 and max are for, so only the
+    // moments use the kept samples
+    r.samples = k;
+    r.outliers = n - k;
+    r.min = samples[0];
+    r.max = samples[n - 1];
+    r.median = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2.0;
+    r.mean = mean;
+    r.p99 = benchmark_percentile(samples, n, 99.0);
+    r.stddev = k > 1 ? sqrt(var / (f64)(k - 1)) : 0.0;
+    return r;
+}
+
+static void fmt_time(char *buf, size_t size, f64 seconds) {
+    if (seconds < 1e-6) {
+        snprintf(buf, size, "%.1fns", seconds * 1e9);
+    } else if (seconds < 1e-3) {
+        snprintf(buf, size, "%.2fus", seconds * 1e6);
+    } else if (seconds < 1.0) {
+        snprintf(buf, size, "%.2fms", seconds * 1e3);
+    } else {
+        snprintf(buf, size, "%.3fs", seconds);
+    }
+}
+
+static void print_header(void) { printf("%-32s %10s %10s %10s %10s %8s %9s\n", "benchmark", "min", "median", "p99", "stddev", "samples", "outliers"); }
+
+void benchmark_print(const benchmark_result_t *r) {
+    char min[16], median[16], p99[16], stddev[16];
+    fmt_time(min, sizeof(min), r->min);
+    fmt_time(median, sizeof(median), r->median);
+    fmt_time(p99, sizeof(p99), r->p99);
+    fmt_time(stddev, sizeof(stddev), r->stddev);
+    printf("%-32s %10s %10s %10s %10s %8u %9u\n", r->name, min, median, p99, stddev, r->samples, r->outliers);
+    benchmark_print_counters(&r->counters);
+}
+
+void benchmark_record(benchmark_results_t *set, benchmark_result_t r, const char *fmt, ...) {
+    assert(set->count < BENCHMARK_MAX_RESULTS);
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(set->names[set->count], sizeof(set->names[set->count]), fmt, args);
+    va_end(args);
+    r.name = set->names[set->count];
+    set->results[set->count++] = r;
+}
+
+void benchmark_write_json(FILE *f, const benchmark_result_t *results, u32 n) {
+    fprintf(f, "[\n");
+    for (u32 i = 0; i < n; i++) {
+        const benchmark_result_t *r = &results[i];
+        fprintf(f, "  {\"name\": \"%s\", \"samples\": %u, \"outliers\": %u, \"batch\": %" PRIu64 ", \"min_ns\": %.1f, \"median_ns\": %.1f, \"mean_ns\": %.1f, \"p99_ns\": %.1f, \"max_ns\": %.1f, \"stddev_ns\": %.1f", r->name, r->samples, r->outliers, r->batch, r->min * 1e9, r->median * 1e9, r->mean * 1e9, r->p99 * 1e9, r->max * 1e9, r->stddev * 1e9);
+        for (u32 c = 0; c < BENCHMARK_COUNTERS; c++) {
+            if (r->counters.valid[c]) {
+                fprintf(f, ", \"%s\": %.1f", counter_names[c], r->counters.value[c]);
+            }
+        }
+        fprintf(f, "}%s\n", i + 1 < n ? "," : "");
+    }
+    fprintf(f, "]\n");
+}
+
+void benchmark_write_csv(FILE *f, const benchmark_result_t *results, u32 n) {
+    fprintf(f, "name,samples,outliers,batch,min_ns,median_ns,mean_ns,p99_ns,max_ns,stddev_ns\n");
+    for (u32 i = 0; i < n; i++) {
+        const benchmark_result_t *r = &results[i];
+        fprintf(f, "%s,%u,%u,%" PRIu64 ",%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n", r->name, r->samples, r->outliers, r->batch, r->min * 1e9, r->median * 1e9, r->mean * 1e9, r->p99 * 1e9, r->max * 1e9, r->stddev * 1e9);
+    }
+}
+
+benchmark_cli_t benchmark_parse_args(i32 argc, char **argv) {
+    benchmark_cli_t cli = {.threshold = 0.10};
+    for (i32 i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--json") && has_value) {
+            cli.json = argv[++i];
+        } else if (!strcmp(argv[i], "--csv") && has_value) {
+            cli.csv = argv[++i];
+        } else if (!strcmp(argv[i], "--baseline") && has_value) {
+            cli.baseline = argv[++i];
+        } else if (!strcmp(argv[i], "--threshold") && has_value) {
+            cli.threshold = strtod(argv[++i], NULL);
+        } else if (!strcmp(argv[i], "--quick")) {
+            cli.quick = true;
+        } else {
+            fprintf(stderr, "usage: %s [--json FILE] [--csv FILE] [--baseline FILE] [--threshold R] [--quick]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    return cli;
+}
+
+benchmark_opts_t benchmark_cli_opts(const benchmark_cli_t *cli) {
+    benchmark_opts_t opts = BENCHMARK_DEFAULTS;
+    if (cli->quick) {
+        opts.warmup = 1;
+        opts.target_seconds = 0.1;
+    }
+    return opts;
+}
+
+void benchmark_scale(benchmark_result_t *r, f64 runs) {
+    r->min /= runs;
+    r->median /= runs;
+    r->mean /= runs;
+    r->p99 /= runs;
+    r->max /= runs;
+    r->stddev /= runs;
+    for (u32 c = 0; c < BENCHMARK_COUNTERS; c++) {
+        r->counters.value[c] /= runs;
+    }
+}
+
+// looks up median_ns for `name` in a file written by benchmark_write_json, negative if missing
+static f64 baseline_median(FILE *f, const char *name) {
+    char line[1024];
+    char key[256];
+    snprintf(key, sizeof(key), "\"name\": \"%s\",", name);
+    rewind(f);
+    while (fgets(line, sizeof(line), f)) {
+        const char *median = strstr(line, "\"median_ns\": ");
+        if (strstr(line, key) && median) {
+            return strtod(median + strlen("\"median_ns\": "), NULL);
+        }
+    }
+    return -1.0;
+}
+
+u32 benchmark_compare_baseline(const char *path, const benchmark_result_t *results, u32 n, f64 threshold) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "no baseline at %s, skipping comparison\n", path);
+        return 0;
+    }
+    u32 regressions = 0;
+    printf("\n%-32s %12s %12s %8s\n", "vs baseline", "baseline", "now", "delta");
+    for (u32 i = 0; i < n; i++) {
+        f64 before = baseline_median(f, results[i].name);
+        if (before <= 0.0) {
+            continue;
+        }
+        f64 now = results[i].median * 1e9;
+        f64 delta = (now - before) / before;
+        bool regressed = delta > threshold;
+        regressions += regressed;
+        printf("%-32s %10.1fns %10.1fns %+7.1f%%%s\n", results[i].name, before, now, delta * 100.0, regressed ? "  REGRESSION" : "");
+    }
+    fclose(f);
+    return regressions;
+}
+
+i32 benchmark_report(const benchmark_cli_t *cli, const benchmark_result_t *results, u32 n) {
+    print_header();
+    for (u32 i = 0; i < n; i++) {
+        benchmark_print(&results[i]);
+    }
+    const char *paths[] = {cli->json, cli->csv};
+    for (u32 p = 0; p < 2; p++) {
+        if (!paths[p]) {
+            continue;
+        }
+        FILE *f = fopen(paths[p], "w");
+        if (!f) {
+            perror(paths[p]);
+            return EXIT_FAILURE;
+        }
+        if (p == 0) {
+            benchmark_write_json(f, results, n);
+        } else {
+            benchmark_write_csv(f, results, n);
+        }
+        fclose(f);
+    }
+    if (cli->baseline && benchmark_compare_baseline(cli->baseline, results, n, cli->threshold) > 0) {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
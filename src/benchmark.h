@@ -1,27 +1,199 @@
 #pragma once
 
+#include "clock.h"
 #include "types.h"
+#include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
-#include <time.h>
+#include <stdlib.h>
 
 // clang-format off
 #define benchmark(name, block) \
     do { \
-        struct timespec start, end; \
-        clock_gettime(CLOCK_MONOTONIC, &start); \
+        u64 start = clock_ns(); \
         block; \
-        clock_gettime(CLOCK_MONOTONIC, &end); \
-        f64 time_spent = (f64)(end.tv_sec - start.tv_sec) + (f64)(end.tv_nsec - start.tv_nsec) / 1e9; \
+        u64 end = clock_ns_ordered(); \
+        f64 time_spent = (f64)(end - start) / 1e9; \
         printf(name " took %.3f seconds to execute\n", time_spent); \
     } while (0)
 
 #define benchmark_silent(block) \
     ({ \
-        struct timespec start, end; \
-        clock_gettime(CLOCK_MONOTONIC, &start); \
+        u64 start = clock_ns(); \
         block; \
-        clock_gettime(CLOCK_MONOTONIC, &end); \
-        (f64)(end.tv_sec - start.tv_sec) + (f64)(end.tv_nsec - start.tv_nsec) / 1e9; \
+        u64 end = clock_ns_ordered(); \
+        (f64)(end - start) / 1e9; \
     })
 // clang-format on
+
+//
+// hardware counters via perf_event_open, one counter group per thread of the process.
+// threads created while counting are picked up through `inherit`. when the kernel refuses
+// (containers, perf_event_paranoid, no pmu) the counters are simply marked invalid.
+//
+
+typedef enum { BENCHMARK_CYCLES, BENCHMARK_INSTRUCTIONS, BENCHMARK_CACHE_MISSES, BENCHMARK_BRANCH_MISSES, BENCHMARK_CONTEXT_SWITCHES, BENCHMARK_COUNTERS } benchmark_counter_t;
+
+#define BENCHMARK_PERF_MAX_THREADS 128
+
+typedef struct {
+    bool valid[BENCHMARK_COUNTERS];
+    f64 value[BENCHMARK_COUNTERS]; // summed over threads, scaled up if the kernel had to multiplex
+} benchmark_counters_t;
+
+typedef struct {
+    u32 threads;
+    i32 fd[BENCHMARK_PERF_MAX_THREADS][BENCHMARK_COUNTERS]; // -1 if unavailable
+} benchmark_perf_t;
+
+void benchmark_perf_open(benchmark_perf_t *p);
+
+void benchmark_perf_start(const benchmark_perf_t *p);
+
+benchmark_counters_t benchmark_perf_stop(const benchmark_perf_t *p);
+
+void benchmark_perf_close(benchmark_perf_t *p);
+
+void benchmark_print_counters(const benchmark_counters_t *counters);
+
+// like benchmark(), plus whatever hardware counters are available
+// clang-format off
+#define benchmark_perf(name, block) \
+    do { \
+        benchmark_perf_t perf_; \
+        benchmark_perf_open(&perf_); \
+        benchmark_perf_start(&perf_); \
+        u64 start = clock_ns(); \
+        block; \
+        u64 end = clock_ns_ordered(); \
+        benchmark_counters_t counters_ = benchmark_perf_stop(&perf_); \
+        benchmark_perf_close(&perf_); \
+        f64 time_spent = (f64)(end - start) / 1e9; \
+        printf(name " took %.3f seconds to execute\n", time_spent); \
+        benchmark_print_counters(&counters_); \
+    } while (0)
+// clang-format on
+
+//
+// statistical harness: warmup, repeated samples, outlier rejection, summary
+//
+
+#define BENCHMARK_MAX_SAMPLES 1000
+#define BENCHMARK_MIN_SAMPLES 10
+#define BENCHMARK_MIN_SAMPLE_SECONDS 1e-4 // fast blocks are batched until one sample takes at least this long
+
+typedef struct {
+    u32 warmup;         // untimed runs before sampling
+    u32 iterations;     // timed samples, 0 to keep sampling until target_seconds is spent
+    f64 target_seconds; // budget for auto-tuned sampling
+    bool counters;      // also collect hardware counters over the sampling phase
+} benchmark_opts_t;
+
+#define BENCHMARK_DEFAULTS ((benchmark_opts_t){.warmup = 3, .iterations = 0, .target_seconds = 1.0, .counters = false})
+
+// all times in seconds per run of the block
+typedef struct {
+    const char *name;
+    u32 samples;  // kept after outlier rejection
+    u32 outliers; // outside the 1.5 IQR tukey fences
+    u64 batch;    // runs of the block per sample
+    f64 min; // over every sample, outliers included
+    f64 median;
+    f64 mean; // over the kept samples only
+    f64 p99;
+    f64 max;
+    f64 stddev; // kept samples only
+    benchmark_counters_t counters; // per run of the block, averaged over all samples
+} benchmark_result_t;
+
+// nearest rank on sorted samples
+f64 benchmark_percentile(const f64 *sorted, u32 n, f64 p);
+
+// sorts `samples` in place
+benchmark_result_t benchmark_summarize(const char *name, f64 *samples, u32 n, u64 batch);
+
+// clang-format off
+#define benchmark_stats(bench_name, bench_opts, block) \
+    ({ \
+        benchmark_opts_t opts_ = (bench_opts); \
+        f64 single_ = 0.0; \
+        for (u32 i_ = 0; i_ < opts_.warmup; i_++) { \
+            u64 start_ = clock_ns(); \
+            block; \
+            single_ = (f64)(clock_ns_ordered() - start_) / 1e9; \
+        } \
+        u64 batch_ = single_ > 0.0 && single_ < BENCHMARK_MIN_SAMPLE_SECONDS ? (u64)(BENCHMARK_MIN_SAMPLE_SECONDS / single_) + 1 : 1; \
+        f64 *samples_ = malloc(BENCHMARK_MAX_SAMPLES * sizeof(f64)); \
+        assert(samples_); \
+        u32 n_ = 0; \
+        f64 spent_ = 0.0; \
+        benchmark_perf_t perf_ = {0}; \
+        if (opts_.counters) { \
+            benchmark_perf_open(&perf_); \
+            benchmark_perf_start(&perf_); \
+        } \
+        while (n_ < BENCHMARK_MAX_SAMPLES && (opts_.iterations ? n_ < opts_.iterations : (n_ < BENCHMARK_MIN_SAMPLES || spent_ < opts_.target_seconds))) { \
+            u64 start_ = clock_ns(); \
+            for (u64 b_ = 0; b_ < batch_; b_++) { \
+                block; \
+            } \
+            f64 t_ = (f64)(clock_ns_ordered() - start_) / 1e9; \
+            samples_[n_++] = t_ / (f64)batch_; \
+            spent_ += t_; \
+        } \
+        benchmark_counters_t counters_ = benchmark_perf_stop(&perf_); \
+        benchmark_perf_close(&perf_); \
+        for (u32 c_ = 0; c_ < BENCHMARK_COUNTERS; c_++) { \
+            counters_.value[c_] /= (f64)n_ * (f64)batch_; \
+        } \
+        benchmark_result_t r_ = benchmark_summarize(bench_name, samples_, n_, batch_); \
+        r_.counters = counters_; \
+        free(samples_); \
+        r_; \
+    })
+// clang-format on
+
+#define BENCHMARK_MAX_RESULTS 64
+
+// what a bench program collects for benchmark_report, with room for the formatted names
+typedef struct {
+    benchmark_result_t results[BENCHMARK_MAX_RESULTS];
+    char names[BENCHMARK_MAX_RESULTS][64];
+    u32 count;
+} benchmark_results_t;
+
+// names the result with printf style arguments, e.g. benchmark_record(&recorded, r, "spawn/workers=%u", n)
+__attribute__((format(printf, 3, 4))) void benchmark_record(benchmark_results_t *set, benchmark_result_t r, const char *fmt, ...);
+
+void benchmark_print(const benchmark_result_t *r);
+
+// one object per line so results can be diffed and grepped, times in nanoseconds
+void benchmark_write_json(FILE *f, const benchmark_result_t *results, u32 n);
+
+void benchmark_write_csv(FILE *f, const benchmark_result_t *results, u32 n);
+
+//
+// command line driver shared by the programs in bench/
+//
+
+typedef struct {
+    const char *json;     // --json FILE
+    const char *csv;      // --csv FILE
+    const char *baseline; // --baseline FILE, json written by an earlier run
+    f64 threshold;        // --threshold R, median slowdown that counts as a regression
+    bool quick;           // --quick, smaller time budget for smoke runs
+} benchmark_cli_t;
+
+benchmark_cli_t benchmark_parse_args(i32 argc, char **argv);
+
+benchmark_opts_t benchmark_cli_opts(const benchmark_cli_t *cli);
+
+// rescales a result measured over `runs` operations to the cost of one operation
+void benchmark_scale(benchmark_result_t *r, f64 runs);
+
+// returns the number of benchmarks whose median got slower than the baseline by more than the threshold
+u32 benchmark_compare_baseline(const char *path, const benchmark_result_t *results, u32 n, f64 threshold);
+
+// prints the table, writes the requested files and returns a process exit code
+i32 benchmark_report(const benchmark_cli_t *cli, const benchmark_result_t *results, u32 n);
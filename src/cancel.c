@@ -0,0 +1,75 @@
+#include "cancel.h"
+#include "clock.h"
+#include "types.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <time.h>
+
+static __thread const cancel_token_t *current_token = NULL;
+
+// one condition for every sleeper, cancel() is rare enough that waking all of them is fine
+static pthread_mutex_t sleep_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sleep_cond;
+static pthread_once_t sleep_once = PTHREAD_ONCE_INIT;
+
+void cancel_init(cancel_token_t *t, const cancel_token_t *parent) {
+    assert(t);
+    atomic_store_explicit(&t->cancelled, false, memory_order_relaxed);
+    t->deadline_ns = 0;
+    t->parent = parent;
+}
+
+void cancel_init_timeout(cancel_token_t *t, const cancel_token_t *parent, u64 timeout_ns) {
+    cancel_init(t, parent);
+    t->deadline_ns = clock_ns() + timeout_ns;
+}
+
+static void create_sleep_cond(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    i32 result = pthread_cond_init(&sleep_cond, &attr);
+    assert(result == 0);
+    pthread_condattr_destroy(&attr);
+}
+
+void cancel(cancel_token_t *t) {
+    assert(t);
+    atomic_store_explicit(&t->cancelled, true, memory_order_release);
+    pthread_once(&sleep_once, create_sleep_cond);
+    pthread_mutex_lock(&sleep_mutex);
+    pthread_cond_broadcast(&sleep_cond);
+    pthread_mutex_unlock(&sleep_mutex);
+}
+
+const cancel_token_t *cancel_current(void) { return current_token; }
+
+const cancel_token_t *cancel_swap_current(const cancel_token_t *t) {
+    const cancel_token_t *previous = current_token;
+    current_token = t;
+    return previous;
+}
+
+cancel_status_t cancel_sleep(u64 ns) {
+    const cancel_token_t *t = current_token;
+    u64 until = clock_ns() + ns;
+    for (const cancel_token_t *p = t; p; p = p->parent) {
+        if (p->deadline_ns && p->deadline_ns < until) {
+            until = p->deadline_ns;
+        }
+    }
+
+    pthread_once(&sleep_once, create_sleep_cond);
+    pthread_mutex_lock(&sleep_mutex);
+    cancel_status_t status;
+    u64 now;
+    while ((status = cancel_status(t)) == CANCEL_OK && (now = clock_ns()) < until) {
+        // the cycle counter and CLOCK_MONOTONIC tick at the same rate, only their origins differ
+        u64 wake = clock_gettime_ns() + (until - now);
+        struct timespec ts = {.tv_sec = (time_t)(wake / 1000000000ULL), .tv_nsec = (long)(wake % 1000000000ULL)};
+        pthread_cond_timedwait(&sleep_cond, &sleep_mutex, &ts);
+    }
+    pthread_mutex_unlock(&sleep_mutex);
+    return status;
+}
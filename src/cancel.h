@@ -0,0 +1,70 @@
+#pragma once
+
+#include "clock.h"
+#include "defer.h"
+#include "types.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// cooperative cancellation. a token counts as cancelled once cancel() was called on it, once its deadline
+// passed, or once any of its ancestors is cancelled, so stopping a request's token stops everything derived
+// from it. checking walks the parent chain with relaxed loads, no locks.
+//
+// spawn, async_spawn and friends attach the token that is current on the spawning thread: the one of the
+// goroutine or coroutine doing the spawn, or one set with cancel_scope. goroutines and coroutines whose
+// token is cancelled before they start are dropped without running, running ones poll cancelled().
+// cancel_sleep and a spawn blocked on a full go queue return early, joins (wait, task_group_wait) don't
+// and only finish sooner because the cancelled work drains without running.
+// tokens are owned by the caller and have to outlive every task attached to them.
+
+typedef enum { CANCEL_OK, CANCEL_CANCELLED, CANCEL_EXPIRED } cancel_status_t;
+
+typedef struct cancel_token {
+    _Atomic bool cancelled;
+    u64 deadline_ns; // clock_ns() based, 0 for none
+    const struct cancel_token *parent;
+} cancel_token_t;
+
+// `parent` may be NULL
+void cancel_init(cancel_token_t *t, const cancel_token_t *parent);
+
+// expires `timeout_ns` from now, or earlier through the parent
+void cancel_init_timeout(cancel_token_t *t, const cancel_token_t *parent, u64 timeout_ns);
+
+// also wakes everyone in cancel_sleep
+void cancel(cancel_token_t *t);
+
+static inline cancel_status_t cancel_status(const cancel_token_t *t) {
+    for (; t; t = t->parent) {
+        if (atomic_load_explicit(&t->cancelled, memory_order_relaxed)) {
+            return CANCEL_CANCELLED;
+        }
+        if (t->deadline_ns && clock_ns() >= t->deadline_ns) {
+            return CANCEL_EXPIRED;
+        }
+    }
+    return CANCEL_OK;
+}
+
+static inline bool cancel_requested(const cancel_token_t *t) { return cancel_status(t) != CANCEL_OK; }
+
+// the token spawns from this thread are attached to, NULL for none
+const cancel_token_t *cancel_current(void);
+
+// makes `t` current on this thread until swapped back, returns the previous one
+const cancel_token_t *cancel_swap_current(const cancel_token_t *t);
+
+// what a task polls to find out whether its result is still wanted
+static inline bool cancelled(void) { return cancel_requested(cancel_current()); }
+
+// sleeps for `ns`, returning early with the reason when the current token is cancelled or expires.
+// blocks the thread, coroutines poll cancelled() around async_yield instead
+cancel_status_t cancel_sleep(u64 ns);
+
+// tasks spawned in the enclosing block are attached to `t`
+// clang-format off
+#define cancel_scope(t) \
+    const cancel_token_t *UNIQUE_NAME(cancel_outer_) = cancel_swap_current(t); \
+    defer({ cancel_swap_current(UNIQUE_NAME(cancel_outer_)); })
+// clang-format on
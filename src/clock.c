@@ -0,0 +1,82 @@
+#include "clock.h"
+#include "types.h"
+
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+#define CALIBRATION_ROUNDS 3
+#define CALIBRATION_NS 1000000 // per round, keeps startup cost around 3ms
+
+clock_source_t clock_source = {.cycle_counter = false, .ticks_per_sec = 1000000000ULL, .mult = 1ULL << CLOCK_SHIFT};
+
+#if defined(__x86_64__)
+// the tsc must tick at a constant rate through frequency and power state changes, and rdtscp must exist
+static bool cycle_counter_usable(void) {
+    u32 eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007) {
+        return false;
+    }
+    __get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+    bool rdtscp = edx & (1u << 27);
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    bool invariant = edx & (1u << 8);
+    return rdtscp && invariant;
+}
+
+static i32 cmp_u64(const void *a, const void *b) {
+    u64 x = *(const u64 *)a;
+    u64 y = *(const u64 *)b;
+    return (x > y) - (x < y);
+}
+
+// busy waits against clock_gettime, the median round is robust to a preemption in any one of them
+static u64 cycle_counter_frequency(void) {
+    u64 rates[CALIBRATION_ROUNDS];
+    for (u32 r = 0; r < CALIBRATION_ROUNDS; r++) {
+        u64 start_ns = clock_gettime_ns();
+        u64 start_ticks = __builtin_ia32_rdtsc();
+        u64 end_ns;
+        do {
+            end_ns = clock_gettime_ns();
+        } while (end_ns - start_ns < CALIBRATION_NS);
+        u64 end_ticks = __builtin_ia32_rdtsc();
+        rates[r] = (u64)((unsigned __int128)(end_ticks - start_ticks) * 1000000000ULL / (end_ns - start_ns));
+    }
+    qsort(rates, CALIBRATION_ROUNDS, sizeof(u64), cmp_u64);
+    return rates[CALIBRATION_ROUNDS / 2];
+}
+#elif defined(__aarch64__)
+static bool cycle_counter_usable(void) { return true; }
+
+// the generic timer reports its own frequency
+static u64 cycle_counter_frequency(void) {
+    u64 frequency;
+    __asm__ volatile("mrs %0, cntfrq_el0" : "=r"(frequency));
+    return frequency;
+}
+#else
+static bool cycle_counter_usable(void) { return false; }
+
+static u64 cycle_counter_frequency(void) { return 0; }
+#endif
+
+// priority 101 runs before default constructors, e.g. the one that starts tracing from the environment
+__attribute__((constructor(101))) static void clock_init(void) {
+    const char *forced = getenv("SHEAF_CLOCK");
+    if (forced && !strcmp(forced, "gettime")) {
+        return;
+    }
+    if (!cycle_counter_usable()) {
+        return;
+    }
+    u64 frequency = cycle_counter_frequency();
+    if (frequency == 0) {
+        return;
+    }
+    clock_source.ticks_per_sec = frequency;
+    clock_source.mult = (u64)(((unsigned __int128)1000000000ULL << CLOCK_SHIFT) / frequency);
+    clock_source.cycle_counter = true;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "types.h"
+
+#include <stdbool.h>
+#include <time.h>
+
+// cheap monotonic timestamps for hot paths. reads the cycle counter (rdtsc on x86-64, cntvct_el0 on aarch64)
+// and scales it to nanoseconds with a fixed point multiplier calibrated at startup. falls back to clock_gettime
+// (served from the vdso) on other architectures, when the tsc isn't invariant, or with SHEAF_CLOCK=gettime set.
+
+#define CLOCK_SHIFT 32
+
+typedef struct {
+    bool cycle_counter; // false when falling back to clock_gettime
+    u64 ticks_per_sec;
+    u64 mult; // ns = ticks * mult >> CLOCK_SHIFT
+} clock_source_t;
+
+// calibrated by a constructor that runs before all default priority constructors
+extern clock_source_t clock_source;
+
+static inline u64 clock_gettime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + (u64)ts.tv_nsec;
+}
+
+// may be reordered with surrounding instructions, good enough to open an interval
+static inline u64 clock_ticks(void) {
+#if defined(__x86_64__)
+    if (__builtin_expect(clock_source.cycle_counter, 1)) {
+        return __builtin_ia32_rdtsc();
+    }
+#elif defined(__aarch64__)
+    if (__builtin_expect(clock_source.cycle_counter, 1)) {
+        u64 ticks;
+        __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+        return ticks;
+    }
+#endif
+    return clock_gettime_ns();
+}
+
+// waits for all earlier instructions to retire before reading, use to close an interval
+static inline u64 clock_ticks_ordered(void) {
+#if defined(__x86_64__)
+    if (__builtin_expect(clock_source.cycle_counter, 1)) {
+        u32 aux;
+        u64 ticks = __builtin_ia32_rdtscp(&aux);
+        __builtin_ia32_lfence();
+        return ticks;
+    }
+#elif defined(__aarch64__)
+    if (__builtin_expect(clock_source.cycle_counter, 1)) {
+        u64 ticks;
+        __asm__ volatile("isb\n\tmrs %0, cntvct_el0" : "=r"(ticks)::"memory");
+        return ticks;
+    }
+#endif
+    return clock_gettime_ns();
+}
+
+static inline u64 clock_ticks_to_ns(u64 ticks) { return (u64)(((unsigned __int128)ticks * clock_source.mult) >> CLOCK_SHIFT); }
+
+static inline u64 clock_ns(void) { return clock_ticks_to_ns(clock_ticks()); }
+
+static inline u64 clock_ns_ordered(void) { return clock_ticks_to_ns(clock_ticks_ordered()); }
@@ -1,88 +1,1434 @@
+#define _GNU_SOURCE
+#include "cancel.h"
+#include "clock.h"
 #include "go.h"
+#include "trace.h"
 #include "types.h"
 
 #include <assert.h>
+#include <dirent.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <linux/mempolicy.h>
 #include <pthread.h>
 #include <sched.h>
 #include <stdatomic.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
-typedef struct {
-    pthread_t thread;
+#define CACHE_LINE 64
+#define PAGE 4096
+#define AGING_NS (10 * 1000 * 1000ull) // a lower priority goroutine waiting this long is run ahead of higher ones
+#define AGING_PERIOD 8                 // pops between checks for aged goroutines
+#define INHERIT GO_PRIORITY_COUNT      // spawns from inside a goroutine take over its priority
+#define SPIN_MIN_NS 1000               // bounds of the self-tuned idle spin
+#define SPIN_MAX_NS (100 * 1000)
+#define CANCEL_POLL_NS (1000 * 1000ull) // how often a spawner blocked on a full queue rechecks its token
+
+struct pool;
+
+// cache line aligned so descriptors handed between workers never share a line
+typedef struct goroutine {
+    _Alignas(CACHE_LINE) struct goroutine *next; // towards the thief end of the deque, or the next free descriptor
+    struct goroutine *prev;                      // towards the owner end of the deque
+    struct pool *owner;                          // pool the descriptor goes back to
+    struct goroutine *parent;                    // spawning goroutine, kept alive until this one finishes
+    task_group_t *group;                         // counted down when this one finishes
+    task_group_t children;                       // what wait() inside this goroutine joins
+    _Atomic u32 refs;                            // 1 for itself plus one per unfinished child
+    const cancel_token_t *token;                 // current where it was spawned, dropped if cancelled before it starts
     fn_ptr func;
-    atomic_bool finished;
+    env_fn_ptr env_func; // set instead of func by spawn_env
+    u64 spawn_ns;        // when it was queued, for aging
+    u8 priority;         // go_priority_t, the queue it waits in
+#ifdef SHEAF_TRACE
+    u64 trace_id;
+#endif
+    _Alignas(16) u8 env[GO_ENV_SIZE]; // captured state, copied in so closures need no trampoline
 } goroutine_t;
 
-static goroutine_t *goroutines[UINT8_MAX + 1] = {0};
-static _Atomic u8 goroutine_count = 0;
-static pthread_mutex_t spawn_mutex = PTHREAD_MUTEX_INITIALIZER;
+// owner pushes and pops at the head (lifo, cache friendly), thieves take from the tail (oldest first)
+typedef struct {
+    pthread_mutex_t lock;
+    goroutine_t *head;
+    goroutine_t *tail;
+} deque_t;
 
-static void *invoke(void *arg) {
-    goroutine_t *g = (goroutine_t *)arg;
-    assert(g != NULL);
-    assert(g->func != NULL);
-    g->func(); // call
-    atomic_store(&g->finished, true);
+// one page per worker, written first by the worker itself so the page lands on its numa node.
+// within the page the queue and each set of counters get their own cache line
+typedef struct {
+    _Alignas(PAGE) u32 id;
+    u32 victim_count;
+    u8 victims[GO_MAX_WORKERS]; // steal order, workers on the same node first
+    u32 pops;                   // local pops, paces the aging checks
+    u64 spin_ns;                // idle spin before parking, self-tuned unless configured
+    deque_t queues[GO_PRIORITY_COUNT];
+    _Alignas(CACHE_LINE) u64 completed; // written by the owner only, summed lazily by go_completed
+#ifdef SHEAF_STATS
+    _Alignas(CACHE_LINE) go_worker_stats_t stats; // written by the owner only
+    u64 latency[GO_LATENCY_BUCKETS];
+#endif
+} worker_t;
+
+typedef struct {
+    i32 cpu; // -1 when unpinned
+    u32 node;
+} placement_t;
+
+static worker_t workers[GO_MAX_WORKERS];
+static pthread_t threads[GO_MAX_WORKERS];
+static placement_t placement[GO_MAX_WORKERS];
+static u32 worker_count = 0;
+static _Atomic u32 workers_started = 0;
+static atomic_bool running = false;
+static pthread_mutex_t init_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static _Atomic u64 pending = 0; // spawned but not finished
+static _Atomic i64 queued = 0;  // spawned but not started
+static _Atomic u32 next_worker = 0;
+
+// batches spawned from outside the pool arrive as one pre-linked chain pushed with a single cas, the first
+// worker that looks takes the whole stack and thieves spread it from there, see spawn_batch
+static _Alignas(CACHE_LINE) _Atomic(goroutine_t *) injected = NULL; // read on every local pop, kept off busier lines
+
+// submission bound, see go_overflow_t
+static u64 queue_limit = 0; // 0 for unbounded
+static go_overflow_t overflow_policy = GO_OVERFLOW_BLOCK;
+static pthread_mutex_t room_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t room_cond = PTHREAD_COND_INITIALIZER;
+static _Atomic u32 blocked = 0; // spawners waiting for room
+static _Atomic u64 overflowed = 0;
+static _Atomic u64 rejected = 0;
+static _Atomic u64 retired = 0; // completions of workers from earlier go_init/go_shutdown cycles
+
+// idle workers spin for a while, then park on a futex. spawners read these on every spawn
+static _Alignas(CACHE_LINE) _Atomic u32 idle_seq = 0; // futex word, bumped by every wakeup
+static _Atomic u32 sleeping = 0;
+static _Atomic u32 spinning = 0;
+static u64 spin_config = 0; // go_config_t.spin_ns
+
+static pthread_mutex_t done_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+static __thread worker_t *self = NULL;
+static __thread goroutine_t *current = NULL; // innermost goroutine running on this worker
+static __thread bool timer_self = false;       // set on the timer thread, which must never wait for room
+
+// descriptors are recycled through per-thread pools. the thread that frees a descriptor is usually not the one
+// that spawned it, so frees from other threads go onto the owner's lock free return stack, which the owner
+// takes over in one exchange once its own free list runs dry. pools outlive their threads and are adopted by
+// new ones, so a late return into the pool of a thread that already exited stays valid.
+typedef struct pool {
+    goroutine_t *local;                                    // owner only
+    _Alignas(CACHE_LINE) _Atomic(goroutine_t *) returned; // pushed by any thread
+    struct pool *next_idle;
+} pool_t;
+
+#define POOL_SLAB 64 // descriptors per malloc
+
+static __thread pool_t *local_pool = NULL;
+static pool_t *idle_pools = NULL;
+static pthread_mutex_t pools_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t pool_key;
+static pthread_once_t pool_key_once = PTHREAD_ONCE_INIT;
+static _Atomic u64 descriptors_allocated = 0;
+
+//
+// instrumentation, compiled out unless SHEAF_STATS
+//
+
+// single writer, so a relaxed load and store is enough and avoids a locked instruction
+static inline void bump(u64 *counter, u64 delta) { __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + delta, __ATOMIC_RELAXED); }
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
+#ifdef SHEAF_STATS
+static _Atomic i64 max_queued = 0;
+
+static inline void stats_spawned(i64 depth) {
+    i64 seen = atomic_load_explicit(&max_queued, memory_order_relaxed);
+    while (depth > seen && !atomic_compare_exchange_weak_explicit(&max_queued, &seen, depth, memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+static inline u64 stats_started(worker_t *w, goroutine_t *g) {
+    u64 now = clock_ns();
+    // clock_ns can read slightly behind on another cpu, which would wrap into the top bucket
+    u64 latency = now > g->spawn_ns ? now - g->spawn_ns : 0;
+    u8 bucket = latency ? (u8)(64 - __builtin_clzll(latency)) : 0;
+    bump(&w->latency[bucket < GO_LATENCY_BUCKETS ? bucket : GO_LATENCY_BUCKETS - 1], 1);
+    return now;
+}
+
+static inline void stats_finished(worker_t *w, u64 start) {
+    u64 now = clock_ns();
+    bump(&w->stats.tasks, 1);
+    bump(&w->stats.busy_ns, now - start);
+}
+
+static inline u64 stats_idle_begin(void) { return clock_ns(); }
+
+static inline void stats_idle_end(worker_t *w, u64 since) { bump(&w->stats.idle_ns, clock_ns() - since); }
+
+static inline void stats_stolen(worker_t *w) { bump(&w->stats.steals, 1); }
+#else
+static inline void stats_spawned(i64 depth) {
+    (void)depth;
+}
+static inline u64 stats_started(worker_t *w, goroutine_t *g) {
+    (void)w;
+    (void)g;
+    return 0;
+}
+static inline void stats_finished(worker_t *w, u64 start) {
+    (void)w;
+    (void)start;
+}
+static inline u64 stats_idle_begin(void) { return 0; }
+static inline void stats_idle_end(worker_t *w, u64 since) {
+    (void)w;
+    (void)since;
+}
+static inline void stats_stolen(worker_t *w) { (void)w; }
+#endif
+
+//
+// descriptor pools
+//
+
+static void retire_pool(void *arg) {
+    pool_t *p = arg;
+    pthread_mutex_lock(&pools_mutex);
+    p->next_idle = idle_pools;
+    idle_pools = p;
+    pthread_mutex_unlock(&pools_mutex);
+}
+
+static void create_pool_key(void) {
+    i32 result = pthread_key_create(&pool_key, retire_pool);
+    assert(result == 0);
+}
+
+static pool_t *pool_for_thread(void) {
+    if (local_pool) {
+        return local_pool;
+    }
+    pthread_mutex_lock(&pools_mutex);
+    pool_t *p = idle_pools;
+    if (p) {
+        idle_pools = p->next_idle;
+    }
+    pthread_mutex_unlock(&pools_mutex);
+    if (!p) {
+        p = aligned_alloc(CACHE_LINE, sizeof(pool_t));
+        assert(p);
+        memset(p, 0, sizeof(pool_t));
+    }
+    // handed to the next thread that needs a pool once this one exits
+    pthread_once(&pool_key_once, create_pool_key);
+    i32 result = pthread_setspecific(pool_key, p);
+    assert(result == 0);
+    local_pool = p;
+    return p;
+}
+
+static goroutine_t *pool_take(void) {
+    pool_t *p = pool_for_thread();
+    if (!p->local) {
+        p->local = atomic_exchange_explicit(&p->returned, NULL, memory_order_acquire);
+    }
+    if (!p->local) {
+        goroutine_t *slab = aligned_alloc(CACHE_LINE, POOL_SLAB * sizeof(goroutine_t));
+        assert(slab);
+        for (u32 i = 0; i < POOL_SLAB; i++) {
+            slab[i].owner = p;
+            slab[i].next = i + 1 < POOL_SLAB ? &slab[i + 1] : NULL;
+        }
+        p->local = slab;
+        atomic_fetch_add_explicit(&descriptors_allocated, POOL_SLAB, memory_order_relaxed);
+    }
+    goroutine_t *g = p->local;
+    p->local = g->next;
+    return g;
+}
+
+static void pool_give(goroutine_t *g) {
+    pool_t *p = g->owner;
+    if (p == local_pool) {
+        g->next = p->local;
+        p->local = g;
+        return;
+    }
+    // the owner only ever swaps the whole stack out, so there is no pop to race with and no aba
+    goroutine_t *head = atomic_load_explicit(&p->returned, memory_order_relaxed);
+    do {
+        g->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&p->returned, &head, g, memory_order_release, memory_order_relaxed));
+}
+
+//
+// per worker deque
+//
+
+static void push_head(deque_t *q, goroutine_t *g) {
+    pthread_mutex_lock(&q->lock);
+    g->prev = NULL;
+    g->next = q->head;
+    if (q->head) {
+        q->head->prev = g;
+    } else {
+        q->tail = g;
+    }
+    q->head = g;
+    pthread_mutex_unlock(&q->lock);
+}
+
+static goroutine_t *pop_head(deque_t *q) {
+    pthread_mutex_lock(&q->lock);
+    goroutine_t *g = q->head;
+    if (g) {
+        q->head = g->next;
+        if (q->head) {
+            q->head->prev = NULL;
+        } else {
+            q->tail = NULL;
+        }
+    }
+    pthread_mutex_unlock(&q->lock);
+    return g;
+}
+
+static goroutine_t *pop_tail(deque_t *q) {
+    // don't queue up behind the owner, just move on to the next victim
+    if (pthread_mutex_trylock(&q->lock) != 0) {
+        return NULL;
+    }
+    goroutine_t *g = q->tail;
+    if (g) {
+        q->tail = g->prev;
+        if (q->tail) {
+            q->tail->next = NULL;
+        } else {
+            q->head = NULL;
+        }
+    }
+    pthread_mutex_unlock(&q->lock);
+    return g;
+}
+
+// the oldest goroutine if it was queued before `deadline`, waits for the lock unlike pop_tail
+static goroutine_t *pop_tail_before(deque_t *q, u64 deadline) {
+    pthread_mutex_lock(&q->lock);
+    goroutine_t *g = q->tail;
+    if (g && g->spawn_ns < deadline) {
+        q->tail = g->prev;
+        if (q->tail) {
+            q->tail->next = NULL;
+        } else {
+            q->head = NULL;
+        }
+    } else {
+        g = NULL;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return g;
+}
+
+// puts a chain linked through `next` in front of the worker's deques with one lock round per level. the
+// first goroutine of the chain ends up nearest the tail, as if each had been spawned in turn
+static void push_chain(worker_t *w, goroutine_t *chain) {
+    goroutine_t *head[GO_PRIORITY_COUNT] = {0};
+    goroutine_t *tail[GO_PRIORITY_COUNT] = {0};
+    while (chain) {
+        goroutine_t *g = chain;
+        chain = g->next;
+        g->prev = NULL;
+        g->next = head[g->priority];
+        if (head[g->priority]) {
+            head[g->priority]->prev = g;
+        } else {
+            tail[g->priority] = g;
+        }
+        head[g->priority] = g;
+    }
+    for (u32 p = 0; p < GO_PRIORITY_COUNT; p++) {
+        if (!head[p]) {
+            continue;
+        }
+        deque_t *q = &w->queues[p];
+        pthread_mutex_lock(&q->lock);
+        tail[p]->next = q->head;
+        if (q->head) {
+            q->head->prev = tail[p];
+        } else {
+            q->tail = tail[p];
+        }
+        q->head = head[p];
+        pthread_mutex_unlock(&q->lock);
+    }
+}
+
+//
+// placement
+//
+
+typedef struct {
+    u32 cpu;
+    u32 node;
+    u32 package;
+    u32 core;
+    u32 sibling; // rank among the hyperthreads of one physical core
+    u32 slot;    // rank of the physical core within its node
+} cpu_info_t;
+
+static u32 read_topology(u32 cpu, const char *name) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/topology/%s", cpu, name);
+    FILE *f = fopen(path, "r");
+    u32 value = 0;
+    if (f) {
+        if (fscanf(f, "%u", &value) != 1) {
+            value = 0;
+        }
+        fclose(f);
+    }
+    return value;
+}
+
+// the nodeN link sysfs puts next to each cpu, the package stands in without numa support
+static u32 cpu_node(u32 cpu) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u", cpu);
+    DIR *dir = opendir(path);
+    if (dir) {
+        struct dirent *e;
+        u32 node;
+        while ((e = readdir(dir)) != NULL) {
+            if (sscanf(e->d_name, "node%u", &node) == 1) {
+                closedir(dir);
+                return node;
+            }
+        }
+        closedir(dir);
+    }
+    return read_topology(cpu, "physical_package_id");
+}
+
+static i32 order(u32 a, u32 b) { return (a > b) - (a < b); }
+
+static i32 compare_compact(const void *a, const void *b) {
+    const cpu_info_t *x = a, *y = b;
+    i32 c = order(x->node, y->node);
+    c = c ? c : order(x->package, y->package);
+    c = c ? c : order(x->core, y->core);
+    return c ? c : order(x->cpu, y->cpu);
+}
+
+static i32 compare_scatter(const void *a, const void *b) {
+    const cpu_info_t *x = a, *y = b;
+    i32 c = order(x->sibling, y->sibling);
+    c = c ? c : order(x->slot, y->slot);
+    return c ? c : order(x->node, y->node);
+}
+
+// cpus this process may run on (taskset, cgroups), in compact order with sibling and slot ranks filled in
+static u32 allowed_cpus(cpu_info_t *out, u32 max) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        return 0;
+    }
+    u32 count = 0;
+    for (u32 cpu = 0; cpu < CPU_SETSIZE && count < max; cpu++) {
+        if (CPU_ISSET(cpu, &set)) {
+            out[count++] = (cpu_info_t){.cpu = cpu, .node = cpu_node(cpu), .package = read_topology(cpu, "physical_package_id"), .core = read_topology(cpu, "core_id")};
+        }
+    }
+    qsort(out, count, sizeof(cpu_info_t), compare_compact);
+    for (u32 i = 0, slot = 0; i < count; i++) {
+        bool same_core = i > 0 && out[i].node == out[i - 1].node && out[i].package == out[i - 1].package && out[i].core == out[i - 1].core;
+        bool same_node = i > 0 && out[i].node == out[i - 1].node;
+        slot = same_core ? slot : (same_node ? slot + 1 : 0);
+        out[i].sibling = same_core ? out[i - 1].sibling + 1 : 0;
+        out[i].slot = slot;
+    }
+    return count;
+}
+
+static void place_workers(const go_config_t *config, u32 count) {
+    static cpu_info_t cpus[CPU_SETSIZE];
+    for (u32 i = 0; i < count; i++) {
+        placement[i] = (placement_t){.cpu = -1, .node = 0};
+    }
+    if (config->affinity == GO_AFFINITY_CPUSET) {
+        assert(config->cpus != NULL && config->cpu_count > 0);
+        for (u32 i = 0; i < count; i++) {
+            u32 cpu = config->cpus[i % config->cpu_count];
+            assert(cpu < CPU_SETSIZE);
+            placement[i] = (placement_t){.cpu = (i32)cpu, .node = cpu_node(cpu)};
+        }
+        return;
+    }
+    if (config->affinity == GO_AFFINITY_NONE) {
+        return;
+    }
+    u32 available = allowed_cpus(cpus, CPU_SETSIZE);
+    if (available == 0) {
+        return;
+    }
+    if (config->affinity == GO_AFFINITY_SCATTER) {
+        qsort(cpus, available, sizeof(cpu_info_t), compare_scatter);
+    }
+    for (u32 i = 0; i < count; i++) {
+        cpu_info_t *c = &cpus[i % available];
+        placement[i] = (placement_t){.cpu = (i32)c->cpu, .node = c->node};
+    }
+}
+
+// runs on the worker, already on its cpu. victims on the own node come first, each group starts right after
+// the worker's own index so thieves of one node don't all hit the same victim first
+static worker_t *claim_slot(u32 id) {
+    worker_t *w = &workers[id];
+    memset(w, 0, sizeof(worker_t));
+    w->id = id;
+    u64 spin = __atomic_load_n(&spin_config, __ATOMIC_RELAXED);
+    w->spin_ns = spin == GO_SPIN_OFF ? 0 : spin == 0 ? SPIN_MAX_NS / 4 : spin;
+    for (u32 p = 0; p < GO_PRIORITY_COUNT; p++) {
+        pthread_mutex_init(&w->queues[p].lock, NULL);
+    }
+    u32 node = placement[id].node;
+    for (u32 pass = 0; pass < 2; pass++) {
+        for (u32 i = 1; i < worker_count; i++) {
+            u32 v = (id + i) % worker_count;
+            if ((placement[v].node == node) == (pass == 0)) {
+                w->victims[w->victim_count++] = (u8)v;
+            }
+        }
+    }
+#ifdef SYS_mbind
+    // first touch only helps the first time a page is written, a restarted pool may be on other cpus now
+    if (placement[id].cpu >= 0 && node < 64) {
+        u64 mask = 1ull << node;
+        (void)syscall(SYS_mbind, (void *)w, sizeof(worker_t), MPOL_PREFERRED, &mask, 64ul, MPOL_MF_MOVE);
+    }
+#endif
+    atomic_fetch_add_explicit(&workers_started, 1, memory_order_release);
+    return w;
+}
+
+//
+// workers
+//
+
+// highest priority first, within a level the newest (lifo). every AGING_PERIOD pops the oldest goroutine of
+// each lower level is checked first, one that waited longer than AGING_NS jumps ahead so bursts of high
+// priority work can't starve background work forever
+static goroutine_t *pop_local(worker_t *w) {
+    if (atomic_load_explicit(&injected, memory_order_relaxed)) {
+        push_chain(w, atomic_exchange_explicit(&injected, NULL, memory_order_acquire));
+    }
+    if (++w->pops % AGING_PERIOD == 0) {
+        u64 now = clock_ns();
+        u64 deadline = now > AGING_NS ? now - AGING_NS : 0;
+        for (u32 p = GO_PRIORITY_COUNT - 1; p > 0; p--) {
+            goroutine_t *g = pop_tail_before(&w->queues[p], deadline);
+            if (g) {
+                return g;
+            }
+        }
+    }
+    for (u32 p = 0; p < GO_PRIORITY_COUNT; p++) {
+        goroutine_t *g = pop_head(&w->queues[p]);
+        if (g) {
+            return g;
+        }
+    }
     return NULL;
 }
 
-void spawn(fn_ptr func) {
-    assert(func != NULL);
+// a higher level anywhere beats a lower one nearby
+static goroutine_t *steal(worker_t *w) {
+    for (u32 p = 0; p < GO_PRIORITY_COUNT; p++) {
+        for (u32 i = 0; i < w->victim_count; i++) {
+            worker_t *victim = &workers[w->victims[i]];
+            goroutine_t *g = pop_tail(&victim->queues[p]);
+            if (g) {
+                stats_stolen(w);
+                trace_event(TRACE_STEAL, TRACE_GO, g->trace_id);
+                return g;
+            }
+        }
+    }
+    return NULL;
+}
 
-    pthread_mutex_lock(&spawn_mutex);
+static void finish_pending(void) {
+    if (atomic_fetch_sub(&pending, 1) == 1) {
+        pthread_mutex_lock(&done_mutex);
+        pthread_cond_broadcast(&done_cond);
+        pthread_mutex_unlock(&done_mutex);
+    }
+}
 
-    u8 current_count = atomic_load(&goroutine_count);
-    assert(current_count < UINT8_MAX);
+// descriptors of goroutines with unfinished children stay alive until the last child counts down
+static void release(goroutine_t *g) {
+    if (atomic_load_explicit(&g->refs, memory_order_acquire) == 1 || atomic_fetch_sub_explicit(&g->refs, 1, memory_order_acq_rel) == 1) {
+        pool_give(g);
+    }
+}
 
-    goroutine_t *g = malloc(sizeof(goroutine_t));
+static void group_done(task_group_t *tg) {
+    // the group may live on the waiter's stack, so it is not touched again once it reaches zero
+    if (atomic_fetch_sub_explicit(&tg->pending, 1, memory_order_acq_rel) == 1) {
+        pthread_mutex_lock(&done_mutex);
+        pthread_cond_broadcast(&done_cond);
+        pthread_mutex_unlock(&done_mutex);
+    }
+}
+
+static void invoke(worker_t *w, goroutine_t *g) {
     assert(g != NULL);
+    assert(g->func != NULL || g->env_func != NULL);
+    atomic_fetch_sub(&queued, 1);
+    if (atomic_load(&blocked) > 0) {
+        pthread_mutex_lock(&room_mutex);
+        pthread_cond_signal(&room_cond);
+        pthread_mutex_unlock(&room_mutex);
+    }
+    u64 start = stats_started(w, g);
+    trace_event(TRACE_START, TRACE_GO, g->trace_id);
+    goroutine_t *outer = current; // not null when helping from inside a join
+    current = g;
+    const cancel_token_t *outer_token = cancel_swap_current(g->token);
+    if (cancel_requested(g->token)) {
+        // cancelled while queued, dropped without running but otherwise finished like any other
+    } else if (g->env_func) {
+        g->env_func(g->env); // call
+    } else {
+        g->func(); // call
+    }
+    cancel_swap_current(outer_token);
+    current = outer;
+    trace_event(TRACE_FINISH, TRACE_GO, g->trace_id);
+    stats_finished(w, start);
+    bump(&w->completed, 1);
+
+    task_group_t *group = g->group;
+    goroutine_t *parent = g->parent;
+    release(g);
+    if (parent) {
+        // implicit groups are only ever joined by a polling worker, no one to wake
+        atomic_fetch_sub_explicit(&group->pending, 1, memory_order_release);
+        release(parent);
+    } else if (group) {
+        group_done(group);
+    }
+
+    finish_pending();
+}
+
+// help first join: instead of blocking the worker, run queued goroutines until the group drains. the own
+// deque comes first, its head holds the children spawned last, then other workers' tails.
+static void help_until_done(worker_t *w, task_group_t *tg) {
+    while (atomic_load_explicit(&tg->pending, memory_order_acquire) > 0) {
+        goroutine_t *g = pop_local(w);
+        if (!g) {
+            g = steal(w);
+        }
+        if (g) {
+            invoke(w, g);
+        } else {
+            sched_yield(); // the remaining children are running on other workers
+        }
+    }
+}
+
+static void futex_wait(_Atomic u32 *word, u32 expected) { (void)syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0); }
 
+static void futex_wake(_Atomic u32 *word, i32 count) { (void)syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0); }
+
+// spins until something is queued or the budget runs out. spinners are counted, a spawn that sees one
+// skips the wakeup because the spinner picks its goroutine up anyway
+static void wake(u64 n);
+
+static bool spin_for_work(worker_t *w) {
+    if (w->spin_ns == 0) {
+        return false;
+    }
+    atomic_fetch_add(&spinning, 1);
+    u64 deadline = clock_ns() + w->spin_ns;
+    while (atomic_load_explicit(&queued, memory_order_relaxed) == 0 && atomic_load_explicit(&running, memory_order_relaxed) && clock_ns() < deadline) {
+        cpu_relax();
+    }
+    atomic_fetch_sub(&spinning, 1);
+    // spawns skip the wakeup while someone spins, so a burst can land on this spinner alone. like go's
+    // runtime when a spinning m finds work, it passes on what it won't take itself, here straight to a
+    // sleeper per goroutine since woken workers don't spin before looking. spawners bump `queued` before
+    // reading `spinning` and this reads `queued` after dropping out of it, so the spawn or the spinner wakes
+    i64 left = atomic_load(&queued);
+    if (left > 1) {
+        wake((u64)(left - 1));
+    }
+    return left > 0;
+}
+
+// spin about twice as long as the last idle gap a spin could have bridged, halve it after gaps too long to
+// spin through. a run of short gaps quickly buys a longer spin, a quiet phase brings it back down
+static void tune_spin(worker_t *w, u64 gap) {
+    if (gap <= SPIN_MAX_NS) {
+        w->spin_ns = gap * 2 < SPIN_MIN_NS ? SPIN_MIN_NS : gap * 2 > SPIN_MAX_NS ? SPIN_MAX_NS : gap * 2;
+    } else {
+        w->spin_ns = w->spin_ns / 2 < SPIN_MIN_NS ? SPIN_MIN_NS : w->spin_ns / 2;
+    }
+}
+
+static void *worker_main(void *arg) {
+    worker_t *w = claim_slot((u32)(uintptr_t)arg);
+    self = w;
+    // stealing trylocks the other slots' queues, which their workers may still be zeroing and initializing
+    while (atomic_load_explicit(&workers_started, memory_order_acquire) < worker_count) {
+        sched_yield();
+    }
+    bool adaptive = __atomic_load_n(&spin_config, __ATOMIC_RELAXED) == 0;
+    u64 idle_since = stats_idle_begin();
+    u64 idle_start = 0; // when the worker last ran out of work, 0 while busy
+
+    while (true) {
+        goroutine_t *g = pop_local(w);
+        if (!g) {
+            g = steal(w);
+        }
+        if (g) {
+            if (adaptive && idle_start) {
+                tune_spin(w, clock_ns() - idle_start);
+            }
+            idle_start = 0;
+            stats_idle_end(w, idle_since);
+            invoke(w, g);
+            idle_since = stats_idle_begin();
+            continue;
+        }
+
+        // nothing to run, spin in case work shows up soon, then park until a spawn or shutdown
+        if (adaptive && !idle_start) {
+            idle_start = clock_ns();
+        }
+        if (spin_for_work(w)) {
+            continue;
+        }
+        // `sleeping` is published before `queued` is checked and spawners bump `queued` before reading
+        // `sleeping`, so at least one side sees the other and no wakeup is lost. the futex only sleeps while
+        // the sequence still matches, a wakeup between the check and the wait returns right away
+        u32 seq = atomic_load(&idle_seq);
+        atomic_fetch_add(&sleeping, 1);
+        if (atomic_load(&running) && atomic_load(&queued) == 0) {
+            futex_wait(&idle_seq, seq);
+        }
+        atomic_fetch_sub(&sleeping, 1);
+        if (!atomic_load(&running)) {
+            break;
+        }
+    }
+
+    stats_idle_end(w, idle_since);
+    self = NULL;
+    return NULL;
+}
+
+void go_init(u32 num_workers) {
+    go_config_t config = {.workers = num_workers, .affinity = GO_AFFINITY_NONE};
+    const char *policy = getenv("SHEAF_AFFINITY");
+    if (policy && strcmp(policy, "compact") == 0) {
+        config.affinity = GO_AFFINITY_COMPACT;
+    } else if (policy && strcmp(policy, "scatter") == 0) {
+        config.affinity = GO_AFFINITY_SCATTER;
+    }
+    go_init_config(&config);
+}
+
+void go_init_config(const go_config_t *config) {
+    assert(config);
+    pthread_mutex_lock(&init_mutex);
+    if (atomic_load(&running)) {
+        pthread_mutex_unlock(&init_mutex);
+        return;
+    }
+
+    static bool registered = false;
+    if (!registered) {
+        atexit(go_shutdown);
+        registered = true;
+    }
+
+    u32 num_workers = config->workers;
+    if (num_workers == 0 && config->affinity != GO_AFFINITY_NONE) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        num_workers = sched_getaffinity(0, sizeof(set), &set) == 0 ? (u32)CPU_COUNT(&set) : 0;
+    }
+    if (num_workers == 0) {
+        i64 online = sysconf(_SC_NPROCESSORS_ONLN);
+        num_workers = online > 0 ? (u32)online : 1;
+    }
+    __atomic_store_n(&worker_count, num_workers < GO_MAX_WORKERS ? num_workers : GO_MAX_WORKERS, __ATOMIC_RELAXED);
+    place_workers(config, worker_count);
+    __atomic_store_n(&queue_limit, config->queue_limit, __ATOMIC_RELAXED);
+    __atomic_store_n(&overflow_policy, config->overflow, __ATOMIC_RELAXED);
+    __atomic_store_n(&spin_config, config->spin_ns, __ATOMIC_RELAXED);
+
+    atomic_store(&running, true);
+    atomic_store(&workers_started, 0);
+    for (u32 i = 0; i < worker_count; i++) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (placement[i].cpu >= 0) {
+            // pinned from the start, so everything the worker touches first is allocated on its node
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET((u32)placement[i].cpu, &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
+        i32 result = pthread_create(&threads[i], &attr, worker_main, (void *)(uintptr_t)i);
+        assert(result == 0);
+        pthread_attr_destroy(&attr);
+    }
+    // spawns push onto the workers' queues, which the workers set up themselves
+    while (atomic_load_explicit(&workers_started, memory_order_acquire) < worker_count) {
+        sched_yield();
+    }
+    pthread_mutex_unlock(&init_mutex);
+}
+
+static void stop_timers(void);
+
+void go_shutdown(void) {
+    // before the pool goes away and outside init_mutex, a timer that fires meanwhile still spawns normally
+    stop_timers();
+    pthread_mutex_lock(&init_mutex);
+    if (!atomic_load(&running)) {
+        pthread_mutex_unlock(&init_mutex);
+        return;
+    }
+
+    atomic_store(&running, false);
+    atomic_fetch_add(&idle_seq, 1);
+    futex_wake(&idle_seq, INT_MAX);
+
+    for (u32 i = 0; i < worker_count; i++) {
+        i32 result = pthread_join(threads[i], NULL);
+        assert(result == 0);
+    }
+
+    // workers drain their queues before exiting, this only catches spawns that raced with shutdown
+    goroutine_t *g = atomic_exchange(&injected, NULL);
+    while (g) {
+        goroutine_t *next = g->next;
+        pool_give(g);
+        atomic_fetch_sub(&queued, 1);
+        atomic_fetch_sub(&pending, 1);
+        g = next;
+    }
+    u64 completed = 0;
+    for (u32 i = 0; i < worker_count; i++) {
+        completed += workers[i].completed;
+        for (u32 p = 0; p < GO_PRIORITY_COUNT; p++) {
+            goroutine_t *g;
+            while ((g = pop_head(&workers[i].queues[p])) != NULL) {
+                pool_give(g);
+                atomic_fetch_sub(&queued, 1);
+                atomic_fetch_sub(&pending, 1);
+            }
+            pthread_mutex_destroy(&workers[i].queues[p].lock);
+        }
+    }
+    __atomic_store_n(&worker_count, 0, __ATOMIC_RELAXED);
+    atomic_fetch_add(&retired, completed);
+
+    pthread_mutex_lock(&done_mutex);
+    pthread_cond_broadcast(&done_cond);
+    pthread_mutex_unlock(&done_mutex);
+    pthread_mutex_lock(&room_mutex);
+    pthread_cond_broadcast(&room_cond);
+    pthread_mutex_unlock(&room_mutex);
+    pthread_mutex_unlock(&init_mutex);
+}
+
+u32 go_worker_count(void) { return atomic_load(&running) ? worker_count : 0; }
+
+i32 go_worker_cpu(u32 worker) { return worker < go_worker_count() ? placement[worker].cpu : -1; }
+
+u64 go_completed(void) {
+    u64 total = atomic_load_explicit(&retired, memory_order_relaxed);
+    u32 count = __atomic_load_n(&worker_count, __ATOMIC_RELAXED);
+    for (u32 i = 0; i < count; i++) {
+        total += __atomic_load_n(&workers[i].completed, __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+static goroutine_t *new_goroutine(void) {
+    if (!atomic_load(&running)) {
+        go_init(0);
+    }
+
+    goroutine_t *g = pool_take();
+    g->parent = NULL;
+    g->group = NULL;
+    atomic_store_explicit(&g->children.pending, 0, memory_order_relaxed);
+    atomic_store_explicit(&g->refs, 1, memory_order_relaxed);
+    g->func = NULL;
+    g->env_func = NULL;
+    g->priority = current ? current->priority : GO_PRIORITY_NORMAL;
+    g->token = cancel_current(); // the running goroutine's inside one, so cancelling a parent reaches its children
+#ifdef SHEAF_TRACE
+    g->trace_id = trace_next_id();
+#endif
+    return g;
+}
+
+// wakes up to `n` parked workers with one futex call, minus the ones spinning: each of those takes a goroutine
+// without being woken. `queued` is bumped before this reads `spinning`, and a spinner rechecks `queued` after
+// it stops counting itself, so skipping the wakeup never strands a goroutine
+static void wake(u64 n) {
+    u32 spinners = atomic_load(&spinning);
+    if (n <= spinners || atomic_load(&sleeping) == 0) {
+        return;
+    }
+    atomic_fetch_add(&idle_seq, 1);
+    futex_wake(&idle_seq, n - spinners < INT_MAX ? (i32)(n - spinners) : INT_MAX);
+}
+
+static void submit(goroutine_t *g) {
+    trace_event(TRACE_SPAWN, TRACE_GO, g->trace_id);
+
+    // `queued` was already bumped when the spawn was admitted
+    atomic_fetch_add(&pending, 1);
+    stats_spawned(atomic_load_explicit(&queued, memory_order_relaxed));
+
+    // nested spawns stay local, everything else is spread round robin
+    worker_t *w = self ? self : &workers[atomic_fetch_add_explicit(&next_worker, 1, memory_order_relaxed) % worker_count];
+    g->spawn_ns = clock_ns();
+    push_head(&w->queues[g->priority], g);
+    wake(1);
+}
+
+static void adopt(goroutine_t *g, task_group_t *tg) {
+    if (tg) {
+        g->group = tg;
+    } else if (current) {
+        // nested spawn, joined by wait() inside the spawning goroutine
+        g->group = &current->children;
+        g->parent = current;
+        atomic_fetch_add_explicit(&current->refs, 1, memory_order_relaxed);
+    } else {
+        return;
+    }
+    atomic_fetch_add_explicit(&g->group->pending, 1, memory_order_relaxed);
+}
+
+// takes a slot under the queue bound, false when the queue is full
+static bool reserve(void) {
+    u64 limit = __atomic_load_n(&queue_limit, __ATOMIC_RELAXED);
+    if (limit == 0) {
+        atomic_fetch_add(&queued, 1);
+        return true;
+    }
+    // only ever counts up below the limit, so a full queue never turns away a spawn that fits meanwhile
+    i64 seen = atomic_load(&queued);
+    do {
+        if ((u64)seen >= limit) {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak(&queued, &seen, seen + 1));
+    return true;
+}
+
+// reserve for `n` slots at once, returns how many fit
+static u32 reserve_batch(u32 n) {
+    u64 limit = __atomic_load_n(&queue_limit, __ATOMIC_RELAXED);
+    if (limit == 0) {
+        atomic_fetch_add(&queued, n);
+        return n;
+    }
+    i64 seen = atomic_load(&queued);
+    u32 fit;
+    do {
+        fit = (u64)seen >= limit ? 0 : limit - (u64)seen < n ? (u32)(limit - (u64)seen) : n;
+        if (fit == 0) {
+            return 0;
+        }
+    } while (!atomic_compare_exchange_weak(&queued, &seen, seen + fit));
+    return fit;
+}
+
+static go_spawn_t admit(void) {
+    if (reserve()) {
+        return GO_SPAWNED;
+    }
+    atomic_fetch_add_explicit(&overflowed, 1, memory_order_relaxed);
+    // queued it would be dropped without running, so it isn't worth waiting for room or running inline
+    const cancel_token_t *token = cancel_current();
+    if (cancel_requested(token)) {
+        return GO_CANCELLED;
+    }
+    go_overflow_t policy = __atomic_load_n(&overflow_policy, __ATOMIC_RELAXED);
+    if (policy == GO_OVERFLOW_REJECT) {
+        atomic_fetch_add_explicit(&rejected, 1, memory_order_relaxed);
+        return GO_REJECTED;
+    }
+    // a worker waiting for room might be the one that has to make it, and a timer thread waiting would hold
+    // back every other due timer
+    if (policy == GO_OVERFLOW_BLOCK && !self && !timer_self) {
+        // `blocked` is published before the retry and workers free a slot before reading it, see invoke
+        pthread_mutex_lock(&room_mutex);
+        atomic_fetch_add(&blocked, 1);
+        bool room;
+        bool gave_up = false;
+        while (!(room = reserve()) && atomic_load(&running) && !(gave_up = cancel_requested(token))) {
+            if (!token) {
+                pthread_cond_wait(&room_cond, &room_mutex);
+                continue;
+            }
+            // cancel() doesn't know about room_cond and deadlines pass silently, so the token is polled
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            u64 recheck = (u64)now.tv_sec * 1000000000ULL + (u64)now.tv_nsec + CANCEL_POLL_NS;
+            struct timespec ts = {.tv_sec = (time_t)(recheck / 1000000000ULL), .tv_nsec = (long)(recheck % 1000000000ULL)};
+            pthread_cond_timedwait(&room_cond, &room_mutex, &ts);
+        }
+        atomic_fetch_sub(&blocked, 1);
+        pthread_mutex_unlock(&room_mutex);
+        if (room) {
+            return GO_SPAWNED;
+        }
+        if (gave_up) {
+            return GO_CANCELLED;
+        }
+    }
+    return GO_RAN_INLINE;
+}
+
+static go_spawn_t spawn_in(task_group_t *tg, u32 priority, fn_ptr func) {
+    assert(func != NULL);
+    assert(priority <= INHERIT);
+    go_spawn_t admitted = admit();
+    if (admitted == GO_RAN_INLINE) {
+        func(); // call
+    }
+    if (admitted != GO_SPAWNED) {
+        return admitted;
+    }
+    goroutine_t *g = new_goroutine();
     g->func = func;
-    atomic_store(&g->finished, false);
+    if (priority != INHERIT) {
+        g->priority = (u8)priority;
+    }
+    adopt(g, tg);
+    submit(g);
+    return GO_SPAWNED;
+}
 
-    u8 idx = atomic_fetch_add(&goroutine_count, 1);
-    assert(idx < UINT8_MAX);
+static go_spawn_t spawn_env_in(task_group_t *tg, u32 priority, env_fn_ptr func, const void *env, u64 size) {
+    assert(func != NULL);
+    assert(priority <= INHERIT);
+    assert(size <= GO_ENV_SIZE);
+    assert(env != NULL || size == 0);
+    go_spawn_t admitted = admit();
+    if (admitted == GO_RAN_INLINE) {
+        // same contract as queued: the function gets its own copy
+        _Alignas(16) u8 copy[GO_ENV_SIZE];
+        if (size > 0) {
+            memcpy(copy, env, size);
+        }
+        func(copy); // call
+    }
+    if (admitted != GO_SPAWNED) {
+        return admitted;
+    }
+    goroutine_t *g = new_goroutine();
+    g->env_func = func;
+    if (priority != INHERIT) {
+        g->priority = (u8)priority;
+    }
+    if (size > 0) {
+        memcpy(g->env, env, size);
+    }
+    adopt(g, tg);
+    submit(g);
+    return GO_SPAWNED;
+}
 
-    goroutines[idx] = g;
+go_spawn_t spawn(fn_ptr func) { return spawn_in(NULL, INHERIT, func); }
 
-    i32 result = pthread_create(&g->thread, NULL, invoke, g);
-    assert(result == 0);
+go_spawn_t spawn_env(env_fn_ptr func, const void *env, u64 size) { return spawn_env_in(NULL, INHERIT, func, env, size); }
 
-    pthread_mutex_unlock(&spawn_mutex);
+go_spawn_t spawn_priority(go_priority_t priority, fn_ptr func) { return spawn_in(NULL, priority, func); }
+
+go_spawn_t spawn_env_priority(go_priority_t priority, env_fn_ptr func, const void *env, u64 size) { return spawn_env_in(NULL, priority, func, env, size); }
+
+go_spawn_t task_group_spawn(task_group_t *tg, fn_ptr func) {
+    assert(tg != NULL);
+    return spawn_in(tg, INHERIT, func);
+}
+
+go_spawn_t task_group_spawn_env(task_group_t *tg, env_fn_ptr func, const void *env, u64 size) {
+    assert(tg != NULL);
+    return spawn_env_in(tg, INHERIT, func, env, size);
+}
+
+u32 spawn_batch(env_fn_ptr func, const void *envs, u64 size, u32 n) {
+    assert(func != NULL);
+    assert(size <= GO_ENV_SIZE);
+    assert(envs != NULL || size == 0);
+    if (!atomic_load(&running)) {
+        go_init(0);
+    }
+    u32 fit = reserve_batch(n);
+
+    // link the chain privately, nothing is shared until it is published
+    goroutine_t *first = NULL;
+    goroutine_t *last = NULL;
+    u64 now = clock_ns();
+    for (u32 i = 0; i < fit; i++) {
+        goroutine_t *g = new_goroutine();
+        g->env_func = func;
+        if (size > 0) {
+            memcpy(g->env, (const u8 *)envs + i * size, size);
+        }
+        if (current) {
+            g->group = &current->children;
+            g->parent = current;
+        }
+        g->spawn_ns = now;
+        g->next = NULL;
+        if (last) {
+            last->next = g;
+        } else {
+            first = g;
+        }
+        last = g;
+        trace_event(TRACE_SPAWN, TRACE_GO, g->trace_id);
+    }
+
+    if (fit > 0) {
+        // counted for the whole batch before any of it can run, see adopt and submit
+        if (current) {
+            atomic_fetch_add_explicit(&current->refs, fit, memory_order_relaxed);
+            atomic_fetch_add_explicit(&current->children.pending, fit, memory_order_relaxed);
+        }
+        atomic_fetch_add(&pending, fit);
+        stats_spawned(atomic_load_explicit(&queued, memory_order_relaxed));
+        if (self) {
+            // nested batches stay local like nested spawns, this worker runs one of them itself
+            push_chain(self, first);
+            wake(fit - 1);
+        } else {
+            goroutine_t *head = atomic_load_explicit(&injected, memory_order_relaxed);
+            do {
+                last->next = head;
+            } while (!atomic_compare_exchange_weak_explicit(&injected, &head, first, memory_order_release, memory_order_relaxed));
+            wake(fit);
+        }
+    }
+
+    // whatever didn't fit under the queue bound goes through the overflow policy one by one
+    u32 spawned = fit;
+    for (u32 i = fit; i < n; i++) {
+        spawned += spawn_env_in(NULL, INHERIT, func, (const u8 *)envs + i * size, size) == GO_SPAWNED;
+    }
+    return spawned;
+}
+
+void task_group_wait(task_group_t *tg) {
+    assert(tg != NULL);
+    if (self) {
+        help_until_done(self, tg);
+        return;
+    }
+    pthread_mutex_lock(&done_mutex);
+    while (atomic_load(&tg->pending) > 0 && atomic_load(&running)) {
+        pthread_cond_wait(&done_cond, &done_mutex);
+    }
+    pthread_mutex_unlock(&done_mutex);
 }
 
 void wait(void) {
-    // barrier
-    bool all_finished = false;
-    while (!all_finished) {
-        pthread_mutex_lock(&spawn_mutex);
-        all_finished = true;
-        u8 current_count = atomic_load(&goroutine_count);
-        for (u8 i = 0; i < current_count; i++) {
-            if (goroutines[i] && !atomic_load(&goroutines[i]->finished)) {
-                all_finished = false;
-                break;
+    // inside a goroutine only its own children are joined, waiting for everything would include itself
+    if (current) {
+        help_until_done(self, &current->children);
+        return;
+    }
+    assert(self == NULL);
+    pthread_mutex_lock(&done_mutex);
+    while (atomic_load(&pending) > 0 && atomic_load(&running)) {
+        pthread_cond_wait(&done_cond, &done_mutex);
+    }
+    pthread_mutex_unlock(&done_mutex);
+}
+
+//
+// timers
+//
+
+// one thread sleeps until the earliest due time in a min-heap, then spawns everything that is due in one go.
+// the condition variable overshoots by tens of microseconds, so it wakes TIMER_SLACK_NS early and spins the rest.
+#define TIMER_SLACK_NS (50 * 1000)
+#define TIMER_BATCH 256 // due timers taken off the heap per lock hold
+
+struct go_timer {
+    u64 period_ns;
+    _Atomic bool stopped;
+    _Atomic u32 refs; // the caller's and the heap entry's, freed by whichever lets go last
+};
+
+typedef struct {
+    u64 due_ns;
+    fn_ptr func;
+    const cancel_token_t *token; // current when it was armed
+    go_timer_t *periodic;        // NULL for spawn_after, which counts as pending until it ran
+} timer_entry_t;
+
+static timer_entry_t *timer_heap = NULL;
+static u32 timer_count = 0;
+static u32 timer_capacity = 0;
+static pthread_mutex_t timer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_cond;
+static pthread_once_t timer_once = PTHREAD_ONCE_INIT;
+static pthread_t timer_thread;
+static bool timers_running = false;
+
+static void timer_release(go_timer_t *t) {
+    if (atomic_fetch_sub_explicit(&t->refs, 1, memory_order_acq_rel) == 1) {
+        free(t);
+    }
+}
+
+static void timer_push(timer_entry_t e) {
+    if (timer_count == timer_capacity) {
+        timer_capacity = timer_capacity ? timer_capacity * 2 : 1024;
+        timer_heap = realloc(timer_heap, timer_capacity * sizeof(timer_entry_t));
+        assert(timer_heap);
+    }
+    u32 i = timer_count++;
+    while (i > 0 && timer_heap[(i - 1) / 2].due_ns > e.due_ns) {
+        timer_heap[i] = timer_heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    timer_heap[i] = e;
+}
+
+static timer_entry_t timer_pop(void) {
+    timer_entry_t top = timer_heap[0];
+    timer_entry_t last = timer_heap[--timer_count];
+    u32 i = 0;
+    while (true) {
+        u32 child = 2 * i + 1;
+        if (child >= timer_count) {
+            break;
+        }
+        if (child + 1 < timer_count && timer_heap[child + 1].due_ns < timer_heap[child].due_ns) {
+            child++;
+        }
+        if (timer_heap[child].due_ns >= last.due_ns) {
+            break;
+        }
+        timer_heap[i] = timer_heap[child];
+        i = child;
+    }
+    if (timer_count > 0) {
+        timer_heap[i] = last;
+    }
+    return top;
+}
+
+// a periodic timer keeps its phase: the next due time is the next multiple of the period after now
+static bool timer_rearm(timer_entry_t *e, u64 now) {
+    if (atomic_load_explicit(&e->periodic->stopped, memory_order_acquire) || cancel_requested(e->token)) {
+        return false;
+    }
+    u64 late = now - e->due_ns;
+    e->due_ns = now + e->periodic->period_ns - late % e->periodic->period_ns;
+    return true;
+}
+
+static void timer_fire(const timer_entry_t *e) {
+    const cancel_token_t *outer = cancel_swap_current(e->token);
+    spawn(e->func);
+    cancel_swap_current(outer);
+    if (!e->periodic) {
+        finish_pending(); // the spawn above holds wait() from here on
+    }
+}
+
+static void *timer_main(void *arg) {
+    (void)arg;
+    timer_self = true;
+    timer_entry_t batch[TIMER_BATCH];
+    pthread_mutex_lock(&timer_mutex);
+    while (timers_running) {
+        if (timer_count == 0) {
+            pthread_cond_wait(&timer_cond, &timer_mutex);
+            continue;
+        }
+        u64 now = clock_ns();
+        u64 due = timer_heap[0].due_ns;
+        if (due > now + TIMER_SLACK_NS) {
+            u64 sleep_until = clock_gettime_ns() + (due - now - TIMER_SLACK_NS);
+            struct timespec ts = {.tv_sec = (time_t)(sleep_until / 1000000000ULL), .tv_nsec = (long)(sleep_until % 1000000000ULL)};
+            pthread_cond_timedwait(&timer_cond, &timer_mutex, &ts);
+            continue;
+        }
+        if (due > now) {
+            pthread_mutex_unlock(&timer_mutex);
+            while (clock_ns() < due) {
+                cpu_relax();
+            }
+            pthread_mutex_lock(&timer_mutex);
+            continue; // an earlier timer may have been armed meanwhile
+        }
+
+        u32 n = 0;
+        while (n < TIMER_BATCH && timer_count > 0 && timer_heap[0].due_ns <= now) {
+            timer_entry_t e = timer_pop();
+            if (e.periodic) {
+                timer_entry_t next = e;
+                if (timer_rearm(&next, now)) {
+                    timer_push(next);
+                } else {
+                    timer_release(e.periodic);
+                    continue;
+                }
             }
+            batch[n++] = e;
+        }
+        pthread_mutex_unlock(&timer_mutex);
+        for (u32 i = 0; i < n; i++) {
+            timer_fire(&batch[i]);
+        }
+        pthread_mutex_lock(&timer_mutex);
+    }
+    pthread_mutex_unlock(&timer_mutex);
+    return NULL;
+}
+
+// pending timers are dropped, one shots stop holding wait()
+static void stop_timers(void) {
+    pthread_mutex_lock(&timer_mutex);
+    if (!timers_running) {
+        pthread_mutex_unlock(&timer_mutex);
+        return;
+    }
+    timers_running = false;
+    pthread_cond_signal(&timer_cond);
+    pthread_mutex_unlock(&timer_mutex);
+    i32 result = pthread_join(timer_thread, NULL);
+    assert(result == 0);
+
+    while (timer_count > 0) {
+        timer_entry_t e = timer_pop();
+        if (e.periodic) {
+            timer_release(e.periodic);
+        } else {
+            finish_pending();
         }
-        pthread_mutex_unlock(&spawn_mutex);
+    }
+    free(timer_heap);
+    timer_heap = NULL;
+    timer_capacity = 0;
+}
 
-        if (!all_finished) {
-            sched_yield(); // avoid busy waiting
+static void create_timer_cond(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    i32 result = pthread_cond_init(&timer_cond, &attr);
+    assert(result == 0);
+    pthread_condattr_destroy(&attr);
+}
+
+static void arm(timer_entry_t e) {
+    assert(e.func != NULL);
+    pthread_once(&timer_once, create_timer_cond);
+    pthread_mutex_lock(&timer_mutex);
+    if (!timers_running) {
+        // go_shutdown stops the timer thread, at exit too
+        if (!atomic_load(&running)) {
+            go_init(0);
         }
+        timers_running = true;
+        i32 result = pthread_create(&timer_thread, NULL, timer_main, NULL);
+        assert(result == 0);
     }
+    timer_push(e);
+    // only a new earliest timer changes how long the timer thread sleeps
+    if (timer_heap[0].due_ns == e.due_ns) {
+        pthread_cond_signal(&timer_cond);
+    }
+    pthread_mutex_unlock(&timer_mutex);
+}
 
-    // cleanup
-    pthread_mutex_lock(&spawn_mutex);
-    u8 final_count = atomic_load(&goroutine_count);
-    for (u8 i = 0; i < final_count; i++) {
-        if (goroutines[i] != NULL) {
-            i32 result = pthread_join(goroutines[i]->thread, NULL);
-            assert(result == 0);
-            free(goroutines[i]);
-            goroutines[i] = NULL;
+void spawn_after(u64 delay_ns, fn_ptr func) {
+    atomic_fetch_add(&pending, 1);
+    arm((timer_entry_t){.due_ns = clock_ns() + delay_ns, .func = func, .token = cancel_current()});
+}
+
+go_timer_t *spawn_every(u64 period_ns, fn_ptr func) {
+    assert(period_ns > 0);
+    go_timer_t *t = malloc(sizeof(go_timer_t));
+    assert(t);
+    t->period_ns = period_ns;
+    atomic_store(&t->stopped, false);
+    atomic_store(&t->refs, 2);
+    arm((timer_entry_t){.due_ns = clock_ns() + period_ns, .func = func, .token = cancel_current(), .periodic = t});
+    return t;
+}
+
+void go_timer_stop(go_timer_t *t) {
+    assert(t);
+    atomic_store_explicit(&t->stopped, true, memory_order_release);
+    timer_release(t);
+}
+
+void go_stats(go_stats_t *out) {
+    assert(out);
+    memset(out, 0, sizeof(*out));
+    out->workers = go_worker_count();
+    out->queue_depth = atomic_load_explicit(&queued, memory_order_relaxed);
+    out->descriptors_allocated = atomic_load_explicit(&descriptors_allocated, memory_order_relaxed);
+    out->overflowed = atomic_load_explicit(&overflowed, memory_order_relaxed);
+    out->rejected = atomic_load_explicit(&rejected, memory_order_relaxed);
+#ifdef SHEAF_STATS
+    out->max_queue_depth = atomic_load_explicit(&max_queued, memory_order_relaxed);
+    for (u32 i = 0; i < out->workers; i++) {
+        worker_t *w = &workers[i];
+        out->worker[i].tasks = __atomic_load_n(&w->stats.tasks, __ATOMIC_RELAXED);
+        out->worker[i].busy_ns = __atomic_load_n(&w->stats.busy_ns, __ATOMIC_RELAXED);
+        out->worker[i].idle_ns = __atomic_load_n(&w->stats.idle_ns, __ATOMIC_RELAXED);
+        out->worker[i].steals = __atomic_load_n(&w->stats.steals, __ATOMIC_RELAXED);
+        for (u32 b = 0; b < GO_LATENCY_BUCKETS; b++) {
+            out->latency[b] += __atomic_load_n(&w->latency[b], __ATOMIC_RELAXED);
         }
     }
-    atomic_store(&goroutine_count, 0);
-    pthread_mutex_unlock(&spawn_mutex);
-}
\ No newline at end of file
+#endif
+}
+
+void go_stats_reset(void) {
+#ifdef SHEAF_STATS
+    atomic_store(&max_queued, atomic_load(&queued));
+    for (u32 i = 0; i < worker_count; i++) {
+        worker_t *w = &workers[i];
+        memset(&w->stats, 0, sizeof(w->stats));
+        memset(w->latency, 0, sizeof(w->latency));
+    }
+#endif
+}
@@ -2,12 +2,82 @@
 
 #include "types.h"
 
+#include <stdatomic.h>
+
 #define CONCAT(a, b) a##b
 #define CONCAT_EXPAND(a, b) CONCAT(a, b)
 #define UNIQUE_NAME(base) CONCAT_EXPAND(base, __LINE__)
 
-void spawn(fn_ptr func);
+#define GO_MAX_WORKERS 64
+
+// goroutines are multiplexed onto a fixed pool of worker threads with per-worker queues and work stealing.
+// the pool starts on the first spawn with one worker per online cpu, unless go_init was called before.
+// the placement policy comes from SHEAF_AFFINITY=compact|scatter, unpinned when unset.
+// goroutines aren't threads: one that blocks in a syscall (sleep, read, a lock) holds its worker until it
+// returns, so at most num_workers blocking goroutines make progress at once and the rest queue behind them.
+// size the pool for that, or use async coroutines with non-blocking io and async_yield, when goroutines mostly
+// wait on io.
+void go_init(u32 num_workers);
+
+typedef enum {
+    GO_AFFINITY_NONE,    // the kernel places and migrates workers
+    GO_AFFINITY_COMPACT, // fill one numa node's cores (hyperthread siblings next to each other) before the next
+    GO_AFFINITY_SCATTER, // round robin over numa nodes, distinct physical cores before siblings
+    GO_AFFINITY_CPUSET,  // worker i on cpus[i % cpu_count]
+} go_affinity_t;
+
+// what a spawn does while queue_limit goroutines are already waiting to start. a spawn under a cancelled
+// token is dropped instead, a blocked one gives up once its token is cancelled. cancelled goroutines that are
+// already queued keep their slot until a worker reaches and drops them
+typedef enum {
+    GO_OVERFLOW_BLOCK,  // wait for room, spawns from inside a goroutine run inline instead so the pool can't deadlock
+    GO_OVERFLOW_INLINE, // run the goroutine right away on the spawning thread
+    GO_OVERFLOW_REJECT, // drop it and report GO_REJECTED
+} go_overflow_t;
+
+typedef struct {
+    u32 workers; // 0 for one per cpu the process may run on
+    go_affinity_t affinity;
+    const u32 *cpus; // GO_AFFINITY_CPUSET only
+    u32 cpu_count;
+    u64 queue_limit; // goroutines spawned but not started, 0 for unbounded
+    go_overflow_t overflow;
+    u64 spin_ns; // how long an idle worker spins before parking, 0 tunes it per worker, GO_SPIN_OFF parks right away
+} go_config_t;
+
+// idle workers spin first, picking up work that arrives soon without a wakeup, then park on a futex. a spawn
+// wakes one parked worker and only if none is spinning, a spinner that finds more work than it takes wakes
+// parked workers for the rest. self-tuned spins track the recent idle gaps, between 1us
+// and 100us: a fixed long spin trades cpu time for latency, parking right away the other way round
+#define GO_SPIN_OFF UINT64_MAX
+
+// pinned workers are created on their cpu and initialize their own queue slot there, so first touch (and an
+// mbind where the kernel allows it) keeps it on the local numa node. steals try same node victims first.
+void go_init_config(const go_config_t *config);
+
+// the cpu a worker is pinned to, -1 when unpinned
+i32 go_worker_cpu(u32 worker);
+
+// drops the armed timers, runs what is still queued, then joins the workers. periodic handles stay valid
+// until their go_timer_stop. registered with atexit, safe to call twice
+void go_shutdown(void);
+
+u32 go_worker_count(void);
+
+// goroutines finished since the process started. every worker counts into its own cache line and this
+// sums them on demand, so it is cheap to poll for progress, e.g. tqdm_open_polled(n, "go", "tasks", go_completed)
+u64 go_completed(void);
+
+typedef enum {
+    GO_SPAWNED,    // queued
+    GO_RAN_INLINE, // the queue was full and it already ran on the caller
+    GO_REJECTED,   // the queue was full and it was dropped
+    GO_CANCELLED,  // the queue was full and the spawner's cancel token was or got cancelled, dropped
+} go_spawn_t;
+
+go_spawn_t spawn(fn_ptr func);
 
+// nested function, so capturing locals of the enclosing function needs an executable stack trampoline
 // clang-format off
 #define go(block) \
     do { \
@@ -16,4 +86,132 @@ void spawn(fn_ptr func);
     } while(0)
 // clang-format on
 
+#define GO_ENV_SIZE 64
+
+// trampoline free closures: `env` is copied into the goroutine itself and `func` gets a pointer to the copy
+go_spawn_t spawn_env(env_fn_ptr func, const void *env, u64 size);
+
+// captures a value by copy for an ordinary function, e.g. go_env(sum_range, (range_t){.from = 0, .to = n})
+// clang-format off
+#define go_env(func, ...) \
+    do { \
+        __typeof__(__VA_ARGS__) UNIQUE_NAME(env_) = __VA_ARGS__; \
+        _Static_assert(sizeof(UNIQUE_NAME(env_)) <= GO_ENV_SIZE, "environment too large for go_env"); \
+        spawn_env(func, &UNIQUE_NAME(env_), sizeof(UNIQUE_NAME(env_))); \
+    } while(0)
+// clang-format on
+
+// outside goroutines: blocks until everything spawned so far has finished. inside a goroutine: joins the
+// goroutines it spawned, running queued work on the same worker meanwhile instead of blocking it. joins
+// don't return early on cancellation, that would leave goroutines running against a finished join. the
+// queued ones of a cancelled token are dropped, so the join only waits for running ones to see cancelled()
 void wait(void);
+
+// a worker runs its high priority goroutines before normal ones and those before background ones, thieves
+// look for the highest level across all workers. nothing is preempted, a goroutine already running finishes
+// first. lower levels age: one that waited for more than about 10ms is run ahead of the rest. spawns from
+// inside a goroutine inherit its priority, so a background fan-out stays in the background.
+typedef enum {
+    GO_PRIORITY_HIGH,
+    GO_PRIORITY_NORMAL,
+    GO_PRIORITY_BACKGROUND,
+    GO_PRIORITY_COUNT,
+} go_priority_t;
+
+go_spawn_t spawn_priority(go_priority_t priority, fn_ptr func);
+
+go_spawn_t spawn_env_priority(go_priority_t priority, env_fn_ptr func, const void *env, u64 size);
+
+// clang-format off
+#define go_env_priority(priority, func, ...) \
+    do { \
+        __typeof__(__VA_ARGS__) UNIQUE_NAME(env_) = __VA_ARGS__; \
+        _Static_assert(sizeof(UNIQUE_NAME(env_)) <= GO_ENV_SIZE, "environment too large for go_env_priority"); \
+        spawn_env_priority(priority, func, &UNIQUE_NAME(env_), sizeof(UNIQUE_NAME(env_))); \
+    } while(0)
+// clang-format on
+
+// spawns `n` goroutines of `func`, the i-th with a copy of the `size` bytes at envs + i * size. the batch is
+// published with one atomic push and wakes only as many idle workers as it has goroutines, instead of a lock
+// round and a wakeup per spawn. returns how many were queued, past a queue_limit the rest are handled one by
+// one under the overflow policy
+u32 spawn_batch(env_fn_ptr func, const void *envs, u64 size, u32 n);
+
+// spawns one goroutine per element of an array, e.g. go_batch(sum_range, ranges, count)
+// clang-format off
+#define go_batch(func, envs, n) \
+    ({ \
+        _Static_assert(sizeof((envs)[0]) <= GO_ENV_SIZE, "element too large for go_batch"); \
+        spawn_batch(func, envs, sizeof((envs)[0]), n); \
+    })
+// clang-format on
+
+// runs `func` on the pool once `delay_ns` passed. no thread sleeps per timer: a single timer thread keeps a
+// min-heap of due times and spawns whatever is due. wait() counts it as spawned from the moment it is armed.
+// the timer thread never waits for room: under GO_OVERFLOW_BLOCK a full queue runs the due work inline on it
+void spawn_after(u64 delay_ns, fn_ptr func);
+
+typedef struct go_timer go_timer_t;
+
+// runs `func` every `period_ns`, the first time one period from now. runs that fall behind are skipped rather
+// than bunched up. wait() doesn't wait for periodic timers, they end with go_timer_stop or their cancel token
+go_timer_t *spawn_every(u64 period_ns, fn_ptr func);
+
+// releases `t`, call it exactly once per spawn_every, also after the timer ended through its cancel token or
+// go_shutdown (then it only frees the handle). `t` must not be used afterwards, a queued run still happens
+void go_timer_stop(go_timer_t *t);
+
+// scoped fork-join, cilk style. spawns through a group are counted on it and task_group_wait returns once
+// they all finished. a worker waiting on a group keeps executing queued goroutines, its own children first,
+// so recursive divide and conquer never blocks a worker or needs more threads than cpus. the group must
+// stay in scope until task_group_wait returns.
+typedef struct {
+    _Atomic u64 pending;
+} task_group_t;
+
+#define TASK_GROUP_INIT ((task_group_t){0})
+
+go_spawn_t task_group_spawn(task_group_t *tg, fn_ptr func);
+
+go_spawn_t task_group_spawn_env(task_group_t *tg, env_fn_ptr func, const void *env, u64 size);
+
+// clang-format off
+#define task_group_go_env(tg, func, ...) \
+    do { \
+        __typeof__(__VA_ARGS__) UNIQUE_NAME(env_) = __VA_ARGS__; \
+        _Static_assert(sizeof(UNIQUE_NAME(env_)) <= GO_ENV_SIZE, "environment too large for task_group_go_env"); \
+        task_group_spawn_env(tg, func, &UNIQUE_NAME(env_), sizeof(UNIQUE_NAME(env_))); \
+    } while(0)
+// clang-format on
+
+void task_group_wait(task_group_t *tg);
+
+//
+// utilization counters, only recorded when built with SHEAF_STATS (`scons stats=1`)
+//
+
+#define GO_LATENCY_BUCKETS 32
+
+typedef struct {
+    u64 tasks;   // goroutines executed
+    u64 busy_ns; // time spent running goroutines
+    u64 idle_ns; // time spent looking for work or asleep
+    u64 steals;  // goroutines taken from another worker's queue
+} go_worker_stats_t;
+
+typedef struct {
+    u32 workers;
+    i64 queue_depth;                   // spawned but not started, always available
+    i64 max_queue_depth;               // high-water mark of queue_depth
+    u64 descriptors_allocated;         // goroutine descriptors ever malloc'd, flat once the pools are warm, always available
+    u64 overflowed;                    // spawns that found the queue full (blocked, ran inline or rejected), always available
+    u64 rejected;                      // of those, dropped under GO_OVERFLOW_REJECT, always available
+    u64 latency[GO_LATENCY_BUCKETS];   // spawn to start, bucket i counts latencies in [2^(i-1), 2^i) ns
+    go_worker_stats_t worker[GO_MAX_WORKERS];
+} go_stats_t;
+
+// reads each worker's own cache line padded slot with relaxed loads, no locks
+void go_stats(go_stats_t *out);
+
+// only meant to be called while the pool is quiescent, e.g. right after wait()
+void go_stats_reset(void);
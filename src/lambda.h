@@ -1,3 +1,9 @@
 #pragma once
 
 #define lambda(return_type, function_body) ({ return_type __fn__ function_body __fn__; })
+
+// a function pointer paired with the state it needs, for when a lambda would have to capture locals.
+// the trampoline gcc builds for a capturing nested function needs an executable stack, this doesn't.
+// e.g. closure_t(i32, i32) add = {add_offset, &offset}; closure_call(add, 5) calls add_offset(&offset, 5)
+#define closure_t(return_type, ...) struct { return_type (*fn)(void *env, ##__VA_ARGS__); void *env; }
+#define closure_call(c, ...) ((c).fn((c).env, ##__VA_ARGS__))
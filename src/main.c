@@ -4,17 +4,43 @@
 #include "tqdm.h"
 #include "types.h"
 
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
+typedef enum { SCENARIO_CPU, SCENARIO_IO, SCENARIO_MIXED, SCENARIO_FANOUT, SCENARIO_COUNT } scenario_t;
+
+static const char *scenario_names[SCENARIO_COUNT] = {"cpu", "io", "mixed", "fanout"};
+
+// what `-n` means per scenario: numbers to test for primality, round trips per task, round trips per io task, numbers per leaf
+static const u64 default_sizes[SCENARIO_COUNT] = {10000000, 2000, 1000, 100000};
+
+#define MESSAGE_SIZE 64
+#define MAX_TASKS 255 // live coroutines the async registry holds
+
 static u32 compute_task_count = 12;
 static u64 prime_limit = 10000000;
+static u64 io_rounds = 2000;
+static u64 leaf_size = 100000;
 
-static volatile u32 compute_progress_go = 0;
-static volatile u32 compute_progress_async = 0;
+// tasks take no arguments, so each one claims its slice of the work from a shared counter
+static u32 cpu_tasks = 0;
+static u32 io_tasks = 0;
+static u32 next_chunk = 0;
+static u32 next_client = 0;
+static u64 chunk_results[MAX_TASKS];
+static u64 client_results[MAX_TASKS];
+static i32 client_fds[MAX_TASKS];
+static i32 server_fds[MAX_TASKS];
 
 static bool is_prime(u64 n) {
     if (n < 2)
@@ -31,29 +57,53 @@ static bool is_prime(u64 n) {
     return true;
 }
 
+static u32 claim(u32 *counter) { return __atomic_fetch_add(counter, 1, __ATOMIC_SEQ_CST); }
+
+static void reset(u32 cpu, u32 io) {
+    cpu_tasks = cpu;
+    io_tasks = io;
+    next_chunk = 0;
+    next_client = 0;
+    memset(chunk_results, 0, sizeof(chunk_results));
+    memset(client_results, 0, sizeof(client_results));
+}
+
+static u64 reduce_results(void) {
+    u64 sum = 0;
+    for (u32 i = 0; i < cpu_tasks; i++) {
+        sum += chunk_results[i];
+    }
+    for (u32 i = 0; i < io_tasks; i++) {
+        sum += client_results[i];
+    }
+    return sum;
+}
+
+//
+// cpu bound: count primes below prime_limit, split evenly
+//
+
 static void count_primes_go(void) {
-    static u32 worker_id = 1;
-    u32 my_id = __atomic_fetch_add(&worker_id, 1, __ATOMIC_SEQ_CST);
+    u32 my_id = claim(&next_chunk);
 
-    u64 start = (my_id - 1) * (prime_limit / compute_task_count);
-    u64 end = my_id * (prime_limit / compute_task_count);
-    u32 count = 0;
+    u64 start = my_id * (prime_limit / cpu_tasks);
+    u64 end = (my_id + 1) * (prime_limit / cpu_tasks);
+    u64 count = 0;
 
     for (u64 n = start; n < end; n++) {
         if (is_prime(n))
             count++;
     }
 
-    __atomic_fetch_add(&compute_progress_go, 1, __ATOMIC_SEQ_CST);
+    chunk_results[my_id] = count;
 }
 
 static void count_primes_async(void) {
-    static u32 worker_id = 1;
-    u32 my_id = __atomic_fetch_add(&worker_id, 1, __ATOMIC_SEQ_CST);
+    u32 my_id = claim(&next_chunk);
 
-    u64 start = (my_id - 1) * (prime_limit / compute_task_count);
-    u64 end = my_id * (prime_limit / compute_task_count);
-    u32 count = 0;
+    u64 start = my_id * (prime_limit / cpu_tasks);
+    u64 end = (my_id + 1) * (prime_limit / cpu_tasks);
+    u64 count = 0;
 
     for (u64 n = start; n < end; n++) {
         if (is_prime(n))
@@ -64,38 +114,353 @@ static void count_primes_async(void) {
         }
     }
 
-    __atomic_fetch_add(&compute_progress_async, 1, __ATOMIC_SEQ_CST);
+    chunk_results[my_id] = count;
 }
 
-static void test_compute_heavy_go(void) {
-    compute_progress_go = 0;
+static u64 test_compute_heavy_go(void) {
+    reset(compute_task_count, 0);
+    tqdm_bar_t *progress = tqdm_open_polled(compute_task_count, "go   ", "tasks", go_completed);
     for (u32 i = 0; i < compute_task_count; i++) {
         spawn(count_primes_go);
     }
+    wait();
+    tqdm_close(progress);
+    return reduce_results();
+}
+
+static u64 test_compute_heavy_async(void) {
+    reset(compute_task_count, 0);
+    tqdm_bar_t *progress = tqdm_open_polled(compute_task_count, "async", "tasks", async_completed);
+    for (u32 i = 0; i < compute_task_count; i++) {
+        async_spawn(count_primes_async);
+    }
+    async_run_all();
+    tqdm_close(progress);
+    return reduce_results();
+}
 
-    while (compute_progress_go < compute_task_count) {
-        tqdm(compute_progress_go, compute_task_count, "go   ", "workers");
-        usleep(10000);
+//
+// io bound: every task is a client doing request/response round trips over a socketpair
+// against an echo server thread outside of both runtimes
+//
+
+static void *echo_server(void *arg) {
+    u32 count = *(u32 *)arg;
+    struct pollfd fds[MAX_TASKS];
+    for (u32 i = 0; i < count; i++) {
+        fds[i] = (struct pollfd){.fd = server_fds[i], .events = POLLIN};
+    }
+
+    u32 open = count;
+    while (open > 0) {
+        i32 ready = poll(fds, count, -1);
+        assert(ready > 0);
+        for (u32 i = 0; i < count; i++) {
+            if (fds[i].fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP))) {
+                continue;
+            }
+            u8 buf[MESSAGE_SIZE];
+            i64 n = read(fds[i].fd, buf, sizeof(buf));
+            if (n <= 0) {
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                open--;
+                continue;
+            }
+            i64 written = write(fds[i].fd, buf, (size_t)n);
+            assert(written == n);
+        }
+    }
+    return NULL;
+}
+
+static void io_setup(u32 count, bool nonblocking, pthread_t *server, u32 *server_count) {
+    for (u32 i = 0; i < count; i++) {
+        i32 pair[2];
+        i32 result = socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+        assert(result == 0);
+        client_fds[i] = pair[0];
+        server_fds[i] = pair[1];
+        if (nonblocking) {
+            result = fcntl(pair[0], F_SETFL, fcntl(pair[0], F_GETFL) | O_NONBLOCK);
+            assert(result == 0);
+        }
+    }
+    *server_count = count;
+    i32 result = pthread_create(server, NULL, echo_server, server_count);
+    assert(result == 0);
+}
+
+static void io_teardown(u32 count, pthread_t server) {
+    for (u32 i = 0; i < count; i++) {
+        close(client_fds[i]);
+    }
+    i32 result = pthread_join(server, NULL);
+    assert(result == 0);
+}
+
+// blocks the worker, like a naive synchronous client would
+static void echo_client_go(void) {
+    u32 my_id = claim(&next_client);
+    u8 msg[MESSAGE_SIZE] = {(u8)my_id};
+    u64 bytes = 0;
+    for (u64 r = 0; r < io_rounds; r++) {
+        i64 written = write(client_fds[my_id], msg, sizeof(msg));
+        assert(written == (i64)sizeof(msg));
+        for (u64 got = 0; got < sizeof(msg);) {
+            i64 n = read(client_fds[my_id], msg + got, sizeof(msg) - got);
+            assert(n > 0);
+            got += (u64)n;
+        }
+        bytes += sizeof(msg);
+    }
+    client_results[my_id] = bytes;
+}
+
+// yields whenever the socket would block
+static void echo_client_async(void) {
+    u32 my_id = claim(&next_client);
+    u8 msg[MESSAGE_SIZE] = {(u8)my_id};
+    u64 bytes = 0;
+    for (u64 r = 0; r < io_rounds; r++) {
+        while (write(client_fds[my_id], msg, sizeof(msg)) < 0) {
+            assert(errno == EAGAIN);
+            async_yield();
+        }
+        for (u64 got = 0; got < sizeof(msg);) {
+            i64 n = read(client_fds[my_id], msg + got, sizeof(msg) - got);
+            if (n < 0) {
+                assert(errno == EAGAIN);
+                async_yield();
+                continue;
+            }
+            assert(n > 0);
+            got += (u64)n;
+        }
+        bytes += sizeof(msg);
+    }
+    client_results[my_id] = bytes;
+}
+
+static u64 test_io_go(void) {
+    pthread_t server;
+    u32 server_count;
+    reset(0, compute_task_count);
+    io_setup(io_tasks, false, &server, &server_count);
+    for (u32 i = 0; i < io_tasks; i++) {
+        spawn(echo_client_go);
     }
     wait();
-    tqdm(compute_task_count, compute_task_count, "go   ", "workers");
+    io_teardown(io_tasks, server);
+    return reduce_results();
+}
+
+static u64 test_io_async(void) {
+    pthread_t server;
+    u32 server_count;
+    reset(0, compute_task_count);
+    io_setup(io_tasks, true, &server, &server_count);
+    for (u32 i = 0; i < io_tasks; i++) {
+        async_spawn(echo_client_async);
+    }
+    async_run_all();
+    io_teardown(io_tasks, server);
+    return reduce_results();
 }
 
-static void test_compute_heavy_async(void) {
-    compute_progress_async = 0;
+//
+// mixed: every other task counts primes, the rest do io round trips
+//
+
+static u64 test_mixed_go(void) {
+    pthread_t server;
+    u32 server_count;
+    reset((compute_task_count + 1) / 2, compute_task_count / 2);
+    tqdm_bar_t *progress = tqdm_open_polled(compute_task_count, "go   ", "tasks", go_completed);
+    io_setup(io_tasks, false, &server, &server_count);
     for (u32 i = 0; i < compute_task_count; i++) {
-        async_spawn(count_primes_async);
+        spawn(i % 2 == 0 ? count_primes_go : echo_client_go);
     }
+    wait();
+    tqdm_close(progress);
+    io_teardown(io_tasks, server);
+    return reduce_results();
+}
+
+static u64 test_mixed_async(void) {
+    pthread_t server;
+    u32 server_count;
+    reset((compute_task_count + 1) / 2, compute_task_count / 2);
+    tqdm_bar_t *progress = tqdm_open_polled(compute_task_count, "async", "tasks", async_completed);
+    io_setup(io_tasks, true, &server, &server_count);
+    for (u32 i = 0; i < compute_task_count; i++) {
+        async_spawn(i % 2 == 0 ? count_primes_async : echo_client_async);
+    }
+    async_run_all();
+    tqdm_close(progress);
+    io_teardown(io_tasks, server);
+    return reduce_results();
+}
+
+//
+// fan-out/fan-in: one root task spawns a leaf per slot, the partial counts are reduced at the end
+//
+
+static u64 count_leaf(u32 my_id, bool yield) {
+    u64 count = 0;
+    for (u64 n = my_id * leaf_size; n < (my_id + 1) * leaf_size; n++) {
+        if (is_prime(n))
+            count++;
+        if (yield && n % 50000 == 0) {
+            async_yield();
+        }
+    }
+    return count;
+}
+
+static u32 leaves_done = 0;
+
+static void leaf_go(void) {
+    u32 my_id = claim(&next_chunk);
+    chunk_results[my_id] = count_leaf(my_id, false);
+}
+
+static void leaf_async(void) {
+    u32 my_id = claim(&next_chunk);
+    chunk_results[my_id] = count_leaf(my_id, true);
+    leaves_done++;
+}
+
+static void fanout_root_go(void) {
+    for (u32 i = 0; i < cpu_tasks; i++) {
+        spawn(leaf_go);
+    }
+}
+
+static u64 fanout_total = 0;
+
+static void fanout_root_async(void) {
+    for (u32 i = 0; i < cpu_tasks; i++) {
+        async_spawn(leaf_async);
+    }
+    // fan-in inside the root: yield to the leaves until all of them are done
+    while (leaves_done < cpu_tasks) {
+        async_yield();
+    }
+    fanout_total = reduce_results();
+}
 
+static u64 test_fanout_go(void) {
+    reset(compute_task_count, 0);
+    spawn(fanout_root_go);
+    wait();
+    return reduce_results();
+}
+
+static u64 test_fanout_async(void) {
+    reset(compute_task_count, 0);
+    leaves_done = 0;
+    async_spawn(fanout_root_async);
     async_run_all();
-    tqdm(compute_task_count, compute_task_count, "async", "workers");
+    return fanout_total;
+}
+
+//
+// driver
+//
+
+typedef u64 (*scenario_fn)(void);
+
+static const scenario_fn go_scenarios[SCENARIO_COUNT] = {test_compute_heavy_go, test_io_go, test_mixed_go, test_fanout_go};
+static const scenario_fn async_scenarios[SCENARIO_COUNT] = {test_compute_heavy_async, test_io_async, test_mixed_async, test_fanout_async};
+
+static void configure(scenario_t scenario, u64 size) {
+    u64 n = size ? size : default_sizes[scenario];
+    prime_limit = scenario == SCENARIO_MIXED ? n * 2000 : n;
+    io_rounds = n;
+    leaf_size = n;
+}
+
+// the async fanout root is a coroutine of its own next to the leaves
+static u32 max_tasks(scenario_t scenario) { return scenario == SCENARIO_FANOUT ? MAX_TASKS - 1 : MAX_TASKS; }
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-s cpu|io|mixed|fanout|all] [-t tasks] [-n size] [-w workers]\n"
+            "  -s  scenario to run, default all\n"
+            "  -t  tasks per scenario (max %u, %u with fanout), default 12\n"
+            "  -n  cpu: numbers to test, io/mixed: round trips per io task, fanout: numbers per leaf\n"
+            "  -w  go worker threads, default one per cpu\n",
+            prog, max_tasks(SCENARIO_CPU), max_tasks(SCENARIO_FANOUT));
+    exit(EXIT_FAILURE);
 }
 
-int main(void) {
-    f64 compute_go_time = benchmark_silent({ test_compute_heavy_go(); });
-    f64 compute_async_time = benchmark_silent({ test_compute_heavy_async(); });
+int main(int argc, char **argv) {
+    i32 selected = -1;
+    u64 size = 0;
+    u32 workers = 0;
 
-    printf("results: go in %.3fs vs async in %.3fs (%.1fx %s)\n", compute_go_time, compute_async_time, compute_go_time < compute_async_time ? compute_async_time / compute_go_time : compute_go_time / compute_async_time, compute_go_time < compute_async_time ? "faster go" : "faster async");
+    i32 opt;
+    while ((opt = getopt(argc, argv, "s:t:n:w:h")) != -1) {
+        switch (opt) {
+        case 's':
+            for (i32 i = 0; i < SCENARIO_COUNT; i++) {
+                if (!strcmp(optarg, scenario_names[i])) {
+                    selected = i;
+                }
+            }
+            if (selected < 0 && strcmp(optarg, "all") != 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 't':
+            compute_task_count = (u32)strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            size = strtoull(optarg, NULL, 10);
+            break;
+        case 'w':
+            workers = (u32)strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (compute_task_count == 0) {
+        usage(argv[0]);
+    }
+    for (i32 s = 0; s < SCENARIO_COUNT; s++) {
+        if ((selected < 0 || s == selected) && compute_task_count > max_tasks((scenario_t)s)) {
+            usage(argv[0]);
+        }
+    }
+    go_init(workers);
+
+    f64 go_times[SCENARIO_COUNT] = {0};
+    f64 async_times[SCENARIO_COUNT] = {0};
+    for (i32 s = 0; s < SCENARIO_COUNT; s++) {
+        if (selected >= 0 && s != selected) {
+            continue;
+        }
+        configure((scenario_t)s, size);
+        u64 go_result = 0, async_result = 0;
+        go_times[s] = benchmark_silent({ go_result = go_scenarios[s](); });
+        async_times[s] = benchmark_silent({ async_result = async_scenarios[s](); });
+        if (go_result != async_result) {
+            fprintf(stderr, "%s: results differ, go %" PRIu64 " vs async %" PRIu64 "\n", scenario_names[s], go_result, async_result);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("\nresults with %u tasks on %u go workers:\n", compute_task_count, go_worker_count());
+    for (i32 s = 0; s < SCENARIO_COUNT; s++) {
+        if (selected >= 0 && s != selected) {
+            continue;
+        }
+        f64 go_time = go_times[s];
+        f64 async_time = async_times[s];
+        printf("  %-7s go in %.3fs vs async in %.3fs (%.1fx %s)\n", scenario_names[s], go_time, async_time, go_time < async_time ? async_time / go_time : go_time / async_time, go_time < async_time ? "faster go" : "faster async");
+    }
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,209 @@
+#include "pipeline.h"
+#include "go.h"
+#include "types.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EMPTY UINT64_MAX // seq of a free in order ring slot
+
+typedef struct {
+    pipeline_t *pipeline;
+    pipeline_token_t token;
+    u32 stage;    // next stage to run
+    bool holding; // already let into that stage by the token that left it
+} carry_env_t;
+
+void pipeline_init(pipeline_t *p, u32 max_tokens) {
+    assert(p);
+    assert(max_tokens > 0);
+    memset(p, 0, sizeof(*p));
+    p->max_tokens = max_tokens;
+    pthread_mutex_init(&p->lock, NULL);
+}
+
+void pipeline_destroy(pipeline_t *p) {
+    assert(p);
+    assert(atomic_load(&p->run.pending) == 0);
+    for (u32 i = 0; i < p->stage_count; i++) {
+        if (p->stages[i].mode != PIPELINE_PARALLEL) {
+            pthread_mutex_destroy(&p->stages[i].lock);
+            free(p->stages[i].ring);
+        }
+    }
+    pthread_mutex_destroy(&p->lock);
+    memset(p, 0, sizeof(*p));
+}
+
+void pipeline_stage(pipeline_t *p, pipeline_mode_t mode, pipeline_fn func, void *env) {
+    assert(p && func);
+    assert(p->stage_count < PIPELINE_MAX_STAGES);
+    assert((p->stage_count > 0 || mode != PIPELINE_PARALLEL) && "the source stage must be serial");
+    assert(atomic_load(&p->run.pending) == 0);
+    pipeline_stage_t *s = &p->stages[p->stage_count++];
+    memset(s, 0, sizeof(*s));
+    s->mode = mode;
+    s->func = func;
+    s->env = env;
+    if (mode != PIPELINE_PARALLEL) {
+        pthread_mutex_init(&s->lock, NULL);
+    }
+    // never more tokens waiting than exist. nothing ever waits for the source, it runs on one goroutine at a time
+    if (mode != PIPELINE_PARALLEL && p->stage_count > 1) {
+        s->ring = malloc(p->max_tokens * sizeof(pipeline_token_t));
+        assert(s->ring);
+    }
+}
+
+//
+// serial stages
+//
+
+static void carry(void *arg);
+
+// a token the pool rejects is carried on right here, dropping it would stall every in order stage behind it
+static void spawn_carry(carry_env_t env) {
+    if (task_group_spawn_env(&env.pipeline->run, carry, &env, sizeof(env)) == GO_REJECTED) {
+        carry(&env);
+    }
+}
+
+// true if the token may run the stage now, otherwise it waits in the ring for the token leaving it
+static bool enter(pipeline_t *p, pipeline_stage_t *s, pipeline_token_t t) {
+    pthread_mutex_lock(&s->lock);
+    bool admitted = !s->busy && (s->mode != PIPELINE_SERIAL_IN_ORDER || t.seq == s->next_seq);
+    if (admitted) {
+        s->busy = true;
+    } else if (s->mode == PIPELINE_SERIAL_IN_ORDER) {
+        // seqs in flight span less than max_tokens, so every waiting token has a slot of its own
+        s->ring[t.seq % p->max_tokens] = t;
+    } else {
+        assert(s->count < p->max_tokens);
+        s->ring[(s->head + s->count++) % p->max_tokens] = t;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return admitted;
+}
+
+// hands the stage straight to the next waiting token, which continues on a goroutine of its own
+static void leave(pipeline_t *p, pipeline_stage_t *s, u32 stage) {
+    pthread_mutex_lock(&s->lock);
+    bool handed = false;
+    pipeline_token_t next;
+    if (s->mode == PIPELINE_SERIAL_IN_ORDER) {
+        pipeline_token_t *slot = &s->ring[++s->next_seq % p->max_tokens];
+        if (slot->seq == s->next_seq) {
+            next = *slot;
+            slot->seq = EMPTY;
+            handed = true;
+        }
+    } else if (s->count > 0) {
+        next = s->ring[s->head];
+        s->head = (s->head + 1) % p->max_tokens;
+        s->count--;
+        handed = true;
+    }
+    s->busy = handed;
+    pthread_mutex_unlock(&s->lock);
+    if (handed) {
+        spawn_carry((carry_env_t){.pipeline = p, .token = next, .stage = stage, .holding = true});
+    }
+}
+
+//
+// tokens
+//
+
+// the source runs on one goroutine at a time, which spawns its successor while tokens are left
+static bool produce(pipeline_t *p, pipeline_token_t *t) {
+    pipeline_stage_t *source = &p->stages[0];
+    void *item = source->func(NULL, source->env); // call
+    pthread_mutex_lock(&p->lock);
+    if (!item) {
+        p->exhausted = true;
+        p->source_active = false;
+        pthread_mutex_unlock(&p->lock);
+        return false;
+    }
+    *t = (pipeline_token_t){.item = item, .seq = p->produced++};
+    bool more = ++p->in_flight < p->max_tokens;
+    p->source_active = more;
+    pthread_mutex_unlock(&p->lock);
+    if (more) {
+        spawn_carry((carry_env_t){.pipeline = p, .stage = 0});
+    }
+    return true;
+}
+
+// a token left the pipeline, which restarts the source if it stopped at the token limit
+static void finish(pipeline_t *p) {
+    pthread_mutex_lock(&p->lock);
+    p->in_flight--;
+    bool restart = !p->source_active && !p->exhausted;
+    if (restart) {
+        p->source_active = true;
+    }
+    pthread_mutex_unlock(&p->lock);
+    if (restart) {
+        spawn_carry((carry_env_t){.pipeline = p, .stage = 0});
+    }
+}
+
+static void carry(void *arg) {
+    carry_env_t env = *(carry_env_t *)arg;
+    pipeline_t *p = env.pipeline;
+    pipeline_token_t t = env.token;
+    u32 stage = env.stage;
+    if (stage == 0) {
+        if (!produce(p, &t)) {
+            return;
+        }
+        stage = 1;
+    }
+    bool holding = env.holding;
+    for (; stage < p->stage_count; stage++, holding = false) {
+        pipeline_stage_t *s = &p->stages[stage];
+        // dropped items still pass in order stages, later tokens wait for their seq
+        bool ordered = s->mode == PIPELINE_SERIAL_IN_ORDER;
+        if (!t.item && !ordered) {
+            continue;
+        }
+        if (s->mode != PIPELINE_PARALLEL && !holding && !enter(p, s, t)) {
+            return; // parked, the token leaving the stage takes it from here
+        }
+        if (t.item) {
+            t.item = s->func(t.item, s->env); // call
+        }
+        if (s->mode != PIPELINE_PARALLEL) {
+            leave(p, s, stage);
+        }
+    }
+    finish(p);
+}
+
+//
+// running
+//
+
+void pipeline_run(pipeline_t *p) {
+    assert(p);
+    assert(p->stage_count > 0);
+    assert(atomic_load(&p->run.pending) == 0 && "previous run still in flight");
+    for (u32 i = 0; i < p->stage_count; i++) {
+        pipeline_stage_t *s = &p->stages[i];
+        s->busy = false;
+        s->next_seq = 0;
+        s->head = 0;
+        s->count = 0;
+        for (u32 j = 0; s->ring && j < p->max_tokens; j++) {
+            s->ring[j].seq = EMPTY;
+        }
+    }
+    p->produced = 0;
+    p->in_flight = 0;
+    p->exhausted = false;
+    p->source_active = true;
+    spawn_carry((carry_env_t){.pipeline = p, .stage = 0});
+    task_group_wait(&p->run);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "go.h"
+#include "types.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+
+// tbb style pipelines on top of the go worker pool. items flow through a fixed sequence of stages as tokens,
+// a goroutine carries its token as far as it can. parallel stages run any number of tokens at once, serial
+// ones one at a time, in the order the source produced them or in whatever order they arrive. a token that
+// finds a serial stage busy waits in that stage's ring and is picked up by whoever leaves the stage next, so
+// no worker ever blocks. at most max_tokens items exist at a time, which caps memory and sizes the rings.
+// a token a GO_OVERFLOW_REJECT pool turns away continues on the thread that passed it on. building
+// allocates, running doesn't.
+
+#define PIPELINE_MAX_STAGES 16
+
+typedef enum {
+    PIPELINE_SERIAL_IN_ORDER,     // one token at a time, in the order the source produced them
+    PIPELINE_SERIAL_OUT_OF_ORDER, // one token at a time, in any order
+    PIPELINE_PARALLEL,            // any number of tokens at once
+} pipeline_mode_t;
+
+// maps a token's item to what the next stage gets. the first stage is the source: it is called with NULL
+// and returns NULL once the input is exhausted. a later stage returning NULL drops the item, the remaining
+// stages aren't called for it
+typedef void *(*pipeline_fn)(void *item, void *env);
+
+typedef struct {
+    void *item;
+    u64 seq; // position in source order
+} pipeline_token_t;
+
+typedef struct {
+    pipeline_mode_t mode;
+    pipeline_fn func;
+    void *env;
+    pthread_mutex_t lock;   // serial stages only, guards everything below
+    bool busy;              // a token is inside
+    u64 next_seq;           // serial in order: the token allowed in next
+    pipeline_token_t *ring; // tokens waiting for the stage, max_tokens slots, NULL for the source
+    u32 head;               // serial out of order: fifo over the ring
+    u32 count;
+} pipeline_stage_t;
+
+typedef struct {
+    pipeline_stage_t stages[PIPELINE_MAX_STAGES];
+    u32 stage_count;
+    u32 max_tokens;
+    pthread_mutex_t lock; // guards the source state below
+    u64 produced;
+    u32 in_flight;      // produced and not through the last stage
+    bool source_active; // a goroutine is producing or about to
+    bool exhausted;     // the source returned NULL
+    task_group_t run;   // goroutines of the current run
+} pipeline_t;
+
+void pipeline_init(pipeline_t *p, u32 max_tokens);
+
+// must not be called while a run is in flight
+void pipeline_destroy(pipeline_t *p);
+
+// appends a stage, the first one is the source and must be serial
+void pipeline_stage(pipeline_t *p, pipeline_mode_t mode, pipeline_fn func, void *env);
+
+// runs until the source is exhausted and every item left the last stage. from inside a goroutine the wait
+// helps with queued work instead of blocking the worker
+void pipeline_run(pipeline_t *p);
@@ -0,0 +1,163 @@
+#include "taskgraph.h"
+#include "go.h"
+#include "types.h"
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    taskgraph_t *graph;
+    u32 index;
+} node_ref_t;
+
+void taskgraph_init(taskgraph_t *g) {
+    assert(g);
+    memset(g, 0, sizeof(*g));
+    g->checked = true;
+}
+
+void taskgraph_destroy(taskgraph_t *g) {
+    assert(g);
+    assert(atomic_load(&g->run.pending) == 0);
+    for (u32 i = 0; i < g->node_count; i++) {
+        free(g->nodes[i].successors);
+    }
+    free(g->nodes);
+    memset(g, 0, sizeof(*g));
+}
+
+//
+// building
+//
+
+static taskgraph_node_t *add_node(taskgraph_t *g) {
+    assert(atomic_load(&g->run.pending) == 0);
+    if (g->node_count == g->node_capacity) {
+        g->node_capacity = g->node_capacity ? g->node_capacity * 2 : 16;
+        g->nodes = realloc(g->nodes, g->node_capacity * sizeof(taskgraph_node_t));
+        assert(g->nodes);
+    }
+    taskgraph_node_t *n = &g->nodes[g->node_count++];
+    memset(n, 0, sizeof(*n));
+    return n;
+}
+
+u32 taskgraph_node(taskgraph_t *g, fn_ptr func) {
+    assert(g && func);
+    add_node(g)->func = func;
+    return g->node_count - 1;
+}
+
+u32 taskgraph_node_env(taskgraph_t *g, env_fn_ptr func, const void *env, u64 size) {
+    assert(g && func);
+    assert(size <= GO_ENV_SIZE);
+    assert(env != NULL || size == 0);
+    taskgraph_node_t *n = add_node(g);
+    n->env_func = func;
+    if (size > 0) {
+        memcpy(n->env, env, size);
+    }
+    return g->node_count - 1;
+}
+
+void taskgraph_edge(taskgraph_t *g, u32 from, u32 to) {
+    assert(g);
+    assert(from < g->node_count && to < g->node_count && from != to);
+    assert(atomic_load(&g->run.pending) == 0);
+    taskgraph_node_t *n = &g->nodes[from];
+    if (n->successor_count == n->successor_capacity) {
+        n->successor_capacity = n->successor_capacity ? n->successor_capacity * 2 : 4;
+        n->successors = realloc(n->successors, n->successor_capacity * sizeof(u32));
+        assert(n->successors);
+    }
+    n->successors[n->successor_count++] = to;
+    g->nodes[to].predecessor_count++;
+    g->checked = false;
+}
+
+// kahn's algorithm, a cycle would leave its nodes waiting forever and the run never finishing
+static void check_acyclic(taskgraph_t *g) {
+    u32 *order = malloc((g->node_count + 1) * sizeof(u32));
+    u32 *indegree = malloc((g->node_count + 1) * sizeof(u32));
+    assert(order && indegree);
+    u32 tail = 0;
+    for (u32 i = 0; i < g->node_count; i++) {
+        indegree[i] = g->nodes[i].predecessor_count;
+        if (indegree[i] == 0) {
+            order[tail++] = i;
+        }
+    }
+    for (u32 head = 0; head < tail; head++) {
+        taskgraph_node_t *n = &g->nodes[order[head]];
+        for (u32 s = 0; s < n->successor_count; s++) {
+            if (--indegree[n->successors[s]] == 0) {
+                order[tail++] = n->successors[s];
+            }
+        }
+    }
+    assert(tail == g->node_count && "task graph has a cycle");
+    free(order);
+    free(indegree);
+    g->checked = true;
+}
+
+//
+// running
+//
+
+static void run_node(void *arg);
+
+// a node the pool rejects runs right here, dropping it would leave its successors waiting forever
+static void spawn_node(taskgraph_t *g, u32 index) {
+    node_ref_t ref = {.graph = g, .index = index};
+    if (task_group_spawn_env(&g->run, run_node, &ref, sizeof(ref)) == GO_REJECTED) {
+        run_node(&ref);
+    }
+}
+
+static void run_node(void *arg) {
+    node_ref_t ref = *(node_ref_t *)arg;
+    taskgraph_t *g = ref.graph;
+    taskgraph_node_t *n = &g->nodes[ref.index];
+    if (n->env_func) {
+        n->env_func(n->env); // call
+    } else {
+        n->func(); // call
+    }
+    // the last predecessor to finish releases the successor, acq_rel so it sees everything its inputs wrote
+    for (u32 s = 0; s < n->successor_count; s++) {
+        u32 next = n->successors[s];
+        if (atomic_fetch_sub_explicit(&g->nodes[next].remaining, 1, memory_order_acq_rel) == 1) {
+            spawn_node(g, next);
+        }
+    }
+}
+
+void taskgraph_submit(taskgraph_t *g) {
+    assert(g);
+    assert(atomic_load(&g->run.pending) == 0 && "previous run still in flight");
+    if (!g->checked) {
+        check_acyclic(g);
+    }
+    // every counter is reset before the first node is spawned, nodes only ever touch their successors
+    for (u32 i = 0; i < g->node_count; i++) {
+        atomic_store_explicit(&g->nodes[i].remaining, g->nodes[i].predecessor_count, memory_order_relaxed);
+    }
+    for (u32 i = 0; i < g->node_count; i++) {
+        if (g->nodes[i].predecessor_count == 0) {
+            spawn_node(g, i);
+        }
+    }
+}
+
+void taskgraph_wait(taskgraph_t *g) {
+    assert(g);
+    task_group_wait(&g->run);
+}
+
+void taskgraph_run(taskgraph_t *g) {
+    taskgraph_submit(g);
+    taskgraph_wait(g);
+}
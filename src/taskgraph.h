@@ -0,0 +1,62 @@
+#pragma once
+
+#include "go.h"
+#include "types.h"
+
+#include <stdbool.h>
+
+// dependency graphs on top of the go worker pool. nodes and edges are declared once, then the graph can be
+// run any number of times. a node is spawned the moment its last predecessor finishes, counted down with an
+// atomic per node, so independent branches overlap instead of lining up behind phase wide wait() barriers.
+// building allocates, running doesn't: the counters are reset in place and the goroutines come from the pools.
+
+typedef struct {
+    fn_ptr func;
+    env_fn_ptr env_func;     // set instead of func by taskgraph_node_env
+    u32 *successors;         // indices of the nodes waiting on this one
+    u32 successor_count;
+    u32 successor_capacity;
+    u32 predecessor_count;   // fixed once the graph is built
+    _Atomic u32 remaining;   // predecessors still running in the current run
+    _Alignas(16) u8 env[GO_ENV_SIZE]; // stays valid across runs, func gets a pointer to it
+} taskgraph_node_t;
+
+typedef struct {
+    taskgraph_node_t *nodes;
+    u32 node_count;
+    u32 node_capacity;
+    bool checked;     // acyclic since the last change
+    task_group_t run; // nodes of the current run that haven't finished
+} taskgraph_t;
+
+void taskgraph_init(taskgraph_t *g);
+
+// must not be called while a run is in flight
+void taskgraph_destroy(taskgraph_t *g);
+
+// returns the node's index, used to declare edges
+u32 taskgraph_node(taskgraph_t *g, fn_ptr func);
+
+u32 taskgraph_node_env(taskgraph_t *g, env_fn_ptr func, const void *env, u64 size);
+
+// clang-format off
+#define taskgraph_node_go_env(g, func, ...) \
+    ({ \
+        __typeof__(__VA_ARGS__) UNIQUE_NAME(env_) = __VA_ARGS__; \
+        _Static_assert(sizeof(UNIQUE_NAME(env_)) <= GO_ENV_SIZE, "environment too large for taskgraph_node_go_env"); \
+        taskgraph_node_env(g, func, &UNIQUE_NAME(env_), sizeof(UNIQUE_NAME(env_))); \
+    })
+// clang-format on
+
+// `to` starts only after `from` finished
+void taskgraph_edge(taskgraph_t *g, u32 from, u32 to);
+
+// spawns the nodes without predecessors and returns, the rest follow as their inputs complete. a node a
+// GO_OVERFLOW_REJECT pool turns away runs on the thread that released it instead
+void taskgraph_submit(taskgraph_t *g);
+
+// joins the current run, helping with queued work when called from inside a goroutine
+void taskgraph_wait(taskgraph_t *g);
+
+// submit and wait
+void taskgraph_run(taskgraph_t *g);
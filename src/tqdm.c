@@ -0,0 +1,231 @@
+#include "tqdm.h"
+#include "clock.h"
+#include "types.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LINE_SIZE 512
+
+typedef enum { BAR_FREE, BAR_OPEN, BAR_CLOSED } bar_state_t;
+
+static tqdm_bar_t bars[TQDM_MAX_BARS];
+static u32 order[TQDM_MAX_BARS]; // slots in the order they were opened, top to bottom on screen
+static u32 bar_count = 0;
+static u32 drawn_lines = 0; // lines of the live area on screen, the cursor sits on the last one
+static u64 last_render_ns = 0;
+static i32 output_fd = STDOUT_FILENO;
+
+static pthread_mutex_t tqdm_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t render_cond;
+static pthread_once_t render_once = PTHREAD_ONCE_INIT;
+static pthread_t render_thread;
+static bool rendering = false;
+static u64 generation = 0; // bumped whenever the render thread is started or told to stop
+
+static char buffer[TQDM_MAX_BARS * LINE_SIZE + 64];
+static u32 length = 0;
+
+__attribute__((format(printf, 1, 2))) static void append(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    i32 n = vsnprintf(buffer + length, sizeof(buffer) - length, fmt, args);
+    va_end(args);
+    if (n > 0) {
+        length += (u32)n < sizeof(buffer) - length ? (u32)n : (u32)(sizeof(buffer) - length - 1);
+    }
+}
+
+static void append_bar(tqdm_bar_t *bar, u64 now) {
+    u64 current = bar->poll ? bar->poll() - bar->base : atomic_load_explicit(&bar->current, memory_order_relaxed);
+    f64 progress = bar->total ? (f64)current / (f64)bar->total : 0.0;
+    if (progress > 1.0) {
+        progress = 1.0;
+    }
+    u32 filled = (u32)(progress * TQDM_BAR_WIDTH);
+    f64 elapsed = (f64)(now - bar->start_ns) / 1e9;
+    f64 rate = elapsed > 0 ? (f64)current / elapsed : 0.0;
+
+    append("%s: %3u%%|", bar->prefix ? bar->prefix : "Progress", (u32)(progress * 100.0));
+    for (u32 i = 0; i < filled; i++) {
+        append("█");
+    }
+    if (filled < TQDM_BAR_WIDTH) {
+        f64 partial = progress * TQDM_BAR_WIDTH - filled;
+        if (partial > 0.75) {
+            append("▊");
+        } else if (partial > 0.5) {
+            append("▌");
+        } else if (partial > 0.25) {
+            append("▎");
+        } else {
+            append("▏");
+        }
+        append("%*s", (i32)(TQDM_BAR_WIDTH - filled - 1), "");
+    }
+    append("| %" PRIu64 "/%" PRIu64 " [%.1fit/s]", current, bar->total, rate);
+    if (bar->postfix && bar->postfix[0] != '\0') {
+        append(" %s", bar->postfix);
+    }
+    append("\x1b[K"); // clear whatever a longer previous line left behind
+}
+
+static void flush_buffer(void) {
+    if (output_fd == STDOUT_FILENO) {
+        fflush(stdout); // keep earlier printf output above the bars
+    }
+    for (u32 written = 0; written < length;) {
+        i64 n = write(output_fd, buffer + written, length - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        written += (u32)n;
+    }
+    length = 0;
+}
+
+// redraws the live area from its top line: closed bars first, so they scroll out of it, then the open ones
+static void render_locked(bool force) {
+    u64 now = clock_ns();
+    if (!force && now - last_render_ns < TQDM_INTERVAL_MS * 1000000ULL) {
+        return;
+    }
+    last_render_ns = now;
+
+    length = 0;
+    if (drawn_lines > 1) {
+        append("\x1b[%uA", drawn_lines - 1);
+    }
+    append("\r");
+    for (u32 i = 0; i < bar_count;) {
+        tqdm_bar_t *bar = &bars[order[i]];
+        if (bar->state != BAR_CLOSED) {
+            i++;
+            continue;
+        }
+        append_bar(bar, now);
+        append("\n");
+        bar->state = BAR_FREE;
+        memmove(&order[i], &order[i + 1], (bar_count - i - 1) * sizeof(u32));
+        bar_count--;
+    }
+    for (u32 i = 0; i < bar_count; i++) {
+        append_bar(&bars[order[i]], now);
+        if (i + 1 < bar_count) {
+            append("\n");
+        }
+    }
+    drawn_lines = bar_count;
+    flush_buffer();
+}
+
+void tqdm_render(void) {
+    pthread_mutex_lock(&tqdm_mutex);
+    render_locked(false);
+    pthread_mutex_unlock(&tqdm_mutex);
+}
+
+static void *render_main(void *arg) {
+    u64 mine = (u64)(uintptr_t)arg;
+    pthread_mutex_lock(&tqdm_mutex);
+    while (generation == mine) {
+        u64 wake = clock_gettime_ns() + TQDM_INTERVAL_MS * 1000000ULL;
+        struct timespec deadline = {.tv_sec = (time_t)(wake / 1000000000ULL), .tv_nsec = (long)(wake % 1000000000ULL)};
+        pthread_cond_timedwait(&render_cond, &tqdm_mutex, &deadline);
+        if (generation == mine) {
+            render_locked(false);
+        }
+    }
+    pthread_mutex_unlock(&tqdm_mutex);
+    return NULL;
+}
+
+static void create_render_cond(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    i32 result = pthread_cond_init(&render_cond, &attr);
+    assert(result == 0);
+    pthread_condattr_destroy(&attr);
+}
+
+tqdm_bar_t *tqdm_open_polled(u64 total, const char *prefix, const char *postfix, u64 (*poll)(void)) {
+    pthread_mutex_lock(&tqdm_mutex);
+    tqdm_bar_t *bar = NULL;
+    for (u32 i = 0; i < TQDM_MAX_BARS && !bar; i++) {
+        if (bars[i].state == BAR_FREE) {
+            bar = &bars[i];
+            order[bar_count++] = i;
+        }
+    }
+    assert(bar && "too many open bars");
+    atomic_store_explicit(&bar->current, 0, memory_order_relaxed);
+    bar->total = total;
+    bar->prefix = prefix;
+    bar->postfix = postfix;
+    bar->start_ns = clock_ns();
+    bar->poll = poll;
+    bar->base = poll ? poll() : 0;
+    bar->state = BAR_OPEN;
+    render_locked(true);
+
+    if (!rendering) {
+        pthread_once(&render_once, create_render_cond);
+        rendering = true;
+        generation++;
+        i32 result = pthread_create(&render_thread, NULL, render_main, (void *)(uintptr_t)generation);
+        assert(result == 0);
+    }
+    pthread_mutex_unlock(&tqdm_mutex);
+    return bar;
+}
+
+tqdm_bar_t *tqdm_open(u64 total, const char *prefix, const char *postfix) { return tqdm_open_polled(total, prefix, postfix, NULL); }
+
+void tqdm_close(tqdm_bar_t *bar) {
+    pthread_mutex_lock(&tqdm_mutex);
+    assert(bar->state == BAR_OPEN);
+    bar->state = BAR_CLOSED;
+    render_locked(true);
+    bool stop = bar_count == 0 && rendering;
+    pthread_t thread = render_thread;
+    if (stop) {
+        // the render thread notices the new generation and exits, joined so no redraw outlives the last bar
+        rendering = false;
+        generation++;
+        pthread_cond_signal(&render_cond);
+    }
+    pthread_mutex_unlock(&tqdm_mutex);
+    if (stop) {
+        i32 result = pthread_join(thread, NULL);
+        assert(result == 0);
+    }
+}
+
+void tqdm(u64 current, u64 total, const char *prefix, const char *postfix) {
+    static tqdm_bar_t *bar = NULL;
+    if (!bar) {
+        bar = tqdm_open(total, prefix, postfix);
+    }
+    tqdm_set(bar, current);
+    if (current >= total) {
+        tqdm_close(bar);
+        bar = NULL;
+    }
+}
+
+void tqdm_output(i32 fd) {
+    pthread_mutex_lock(&tqdm_mutex);
+    output_fd = fd;
+    pthread_mutex_unlock(&tqdm_mutex);
+}
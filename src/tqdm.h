@@ -1,61 +1,50 @@
 #pragma once
 
-#include "defer.h"
 #include "types.h"
 
-#include <inttypes.h>
-#include <stdio.h>
-#include <sys/time.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// progress bars that any thread can advance with a relaxed atomic add. a background thread redraws all
+// open bars at most every TQDM_INTERVAL_MS with a single write, so updates are cheap enough for hot loops.
+// bars are stacked in the order they were opened, a closed bar is drawn one last time and scrolls away.
+// a polled bar instead asks a counter for its value on every redraw, e.g. go_completed or async_completed,
+// so the runtimes report progress without any update calls on the hot path.
 
 #define TQDM_BAR_WIDTH 40
+#define TQDM_MAX_BARS 16
+#define TQDM_INTERVAL_MS 50
+
+typedef struct {
+    _Alignas(64) _Atomic u64 current; // the only field written after tqdm_open, the rest of the line is read only
+    u64 total;
+    const char *prefix;
+    const char *postfix;
+    u64 start_ns;
+    u64 (*poll)(void); // NULL unless opened with tqdm_open_polled
+    u64 base;          // value of poll when the bar was opened
+    u32 state;
+} tqdm_bar_t;
+
+// starts the render thread with the first open bar
+tqdm_bar_t *tqdm_open(u64 total, const char *prefix, const char *postfix);
+
+// shows how far `poll` has advanced since the bar was opened, polled from the render thread
+tqdm_bar_t *tqdm_open_polled(u64 total, const char *prefix, const char *postfix, u64 (*poll)(void));
+
+// draws the final state and stops the render thread with the last open bar
+void tqdm_close(tqdm_bar_t *bar);
+
+// redraws if TQDM_INTERVAL_MS have passed since the last redraw, the render thread calls this on its own
+void tqdm_render(void);
+
+// defaults to stdout
+void tqdm_output(i32 fd);
+
+// the single bar api from before handles: opens a bar on the first call, sets it to `current` and closes
+// it once `current` reaches `total`. prefix and postfix are taken from the call that opened it
+void tqdm(u64 current, u64 total, const char *prefix, const char *postfix);
+
+static inline void tqdm_update(tqdm_bar_t *bar, u64 delta) { atomic_fetch_add_explicit(&bar->current, delta, memory_order_relaxed); }
 
-static struct timeval start_time = {0, 0};
-
-static inline void tqdm(u64 current, u64 total, const char *prefix, const char *postfix) {
-    if (start_time.tv_sec == 0 && start_time.tv_usec == 0) {
-        gettimeofday(&start_time, NULL);
-    }
-
-    f64 progress = (f64)current / (f64)total;
-    u32 percentage = (u32)(progress * 100.0);
-    u32 bar_width = TQDM_BAR_WIDTH;
-    u32 filled = (u32)(progress * bar_width);
-
-    struct timeval now;
-    gettimeofday(&now, NULL);
-    f64 elapsed = (f64)(now.tv_sec - start_time.tv_sec) + (f64)(now.tv_usec - start_time.tv_usec) / 1e6;
-    f64 rate = (elapsed > 0) ? (f64)current / elapsed : 0.0;
-
-    printf("\r%s: %3u%%|", prefix ? prefix : "Progress", percentage);
-    for (u32 i = 0; i < filled; i++) {
-        printf("█");
-    }
-    if (filled < bar_width) {
-        f64 partial = (progress * bar_width) - filled;
-        if (partial > 0.75) {
-            printf("▊");
-        } else if (partial > 0.5) {
-            printf("▌");
-        } else if (partial > 0.25) {
-            printf("▎");
-        } else {
-            printf("▏");
-        }
-        for (u32 i = filled + 1; i < bar_width; i++) {
-            printf(" ");
-        }
-    }
-    printf("| %" PRIu64 "/%" PRIu64 " [%.1fit/s]", current, total, rate);
-    if (postfix && postfix[0] != '\0') {
-        printf(" %s", postfix);
-    }
-    printf("   ");
-    fflush(stdout);
-
-    // reset for next use
-    if (current >= total) {
-        start_time.tv_sec = 0;
-        start_time.tv_usec = 0;
-        printf("\n");
-    }
-}
+static inline void tqdm_set(tqdm_bar_t *bar, u64 current) { atomic_store_explicit(&bar->current, current, memory_order_relaxed); }
@@ -0,0 +1,269 @@
+#define _GNU_SOURCE
+#include "clock.h"
+#include "trace.h"
+#include "types.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifdef SHEAF_TRACE
+
+typedef struct {
+    u64 ts_ns;
+    u64 id;
+    u8 kind;
+    u8 runtime;
+} trace_entry_t;
+
+// single producer ring: only the owning thread writes, the flush reads once every writer left its ring
+typedef struct trace_ring {
+    struct trace_ring *next; // all rings of live threads, plus exited ones waiting for the next flush
+    i32 tid;
+    bool exited;             // the owner is gone, freed after its events were flushed
+    _Atomic bool writing;    // the owner is between its enabled check and publishing the event
+    _Atomic u64 head;
+    trace_entry_t entries[TRACE_RING_EVENTS];
+} trace_ring_t;
+
+atomic_bool trace_enabled = false;
+
+static trace_ring_t *rings = NULL; // guarded by trace_mutex
+static _Atomic u64 next_id = 1;
+static __thread trace_ring_t *local_ring = NULL;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static char *trace_path = NULL;
+static u64 trace_epoch_ns = 0;
+
+// unlinks and frees the rings of exited threads, trace_mutex held
+static void free_exited_rings(void) {
+    for (trace_ring_t **link = &rings; *link;) {
+        trace_ring_t *r = *link;
+        if (r->exited) {
+            *link = r->next;
+            free(r);
+        } else {
+            link = &r->next;
+        }
+    }
+}
+
+// a ring outlives its thread while recording, so events of threads that already exited still get flushed
+static void retire_ring(void *arg) {
+    trace_ring_t *r = arg;
+    pthread_mutex_lock(&trace_mutex);
+    r->exited = true;
+    if (!atomic_load(&trace_enabled)) {
+        free_exited_rings();
+    }
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+static void create_ring_key(void) {
+    i32 result = pthread_key_create(&ring_key, retire_ring);
+    assert(result == 0);
+}
+
+static trace_ring_t *ring_for_thread(void) {
+    if (local_ring) {
+        return local_ring;
+    }
+    trace_ring_t *r = calloc(1, sizeof(trace_ring_t));
+    assert(r);
+    r->tid = (i32)syscall(SYS_gettid);
+    pthread_once(&ring_key_once, create_ring_key);
+    i32 result = pthread_setspecific(ring_key, r);
+    assert(result == 0);
+
+    pthread_mutex_lock(&trace_mutex);
+    r->next = rings;
+    rings = r;
+    pthread_mutex_unlock(&trace_mutex);
+
+    local_ring = r;
+    return r;
+}
+
+void trace_record(trace_kind_t kind, trace_runtime_t runtime, u64 id) {
+    trace_ring_t *r = ring_for_thread();
+    // `writing` is published before `trace_enabled` is rechecked and trace_stop clears `trace_enabled` before
+    // reading `writing`, so either this sees the stop or the stop waits for this event
+    atomic_store(&r->writing, true);
+    if (!atomic_load(&trace_enabled)) {
+        atomic_store_explicit(&r->writing, false, memory_order_release);
+        return;
+    }
+    u64 head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    trace_entry_t *e = &r->entries[head % TRACE_RING_EVENTS];
+    e->ts_ns = clock_ns();
+    e->id = id;
+    e->kind = (u8)kind;
+    e->runtime = (u8)runtime;
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    atomic_store_explicit(&r->writing, false, memory_order_release);
+}
+
+u64 trace_next_id(void) { return atomic_fetch_add_explicit(&next_id, 1, memory_order_relaxed); }
+
+bool trace_start(const char *path) {
+    assert(path);
+    pthread_mutex_lock(&trace_mutex);
+    if (atomic_load(&trace_enabled)) {
+        pthread_mutex_unlock(&trace_mutex);
+        return false;
+    }
+
+    static bool registered = false;
+    if (!registered) {
+        atexit(trace_stop);
+        registered = true;
+    }
+
+    for (trace_ring_t *r = rings; r; r = r->next) {
+        atomic_store(&r->head, 0);
+    }
+    trace_path = strdup(path);
+    assert(trace_path);
+    trace_epoch_ns = clock_ns();
+    atomic_store(&trace_enabled, true);
+    pthread_mutex_unlock(&trace_mutex);
+    return true;
+}
+
+static const char *runtime_name(u8 runtime) { return runtime == TRACE_GO ? "go" : "async"; }
+
+static bool opens_slice(u8 kind) { return kind == TRACE_START || kind == TRACE_RESUME; }
+
+static bool closes_slice(u8 kind) { return kind == TRACE_YIELD || kind == TRACE_FINISH; }
+
+static void write_entry(FILE *f, const trace_ring_t *r, const trace_entry_t *e, bool *first) {
+    f64 ts = (f64)(e->ts_ns - trace_epoch_ns) / 1e3; // microseconds
+    const char *name = runtime_name(e->runtime);
+    const char *sep = *first ? "" : ",\n";
+    *first = false;
+
+    switch ((trace_kind_t)e->kind) {
+    case TRACE_START:
+    case TRACE_RESUME:
+        // slices nest per thread, flow arrows connect them back to the spawn
+        fprintf(f, "%s{\"name\":\"%s #%" PRIu64 "\",\"cat\":\"%s\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"event\":\"%s\"}}", sep, name, e->id, name, ts, r->tid, e->kind == TRACE_START ? "start" : "resume");
+        if (e->kind == TRACE_START) {
+            fprintf(f, ",\n{\"name\":\"spawn\",\"cat\":\"%s\",\"ph\":\"f\",\"bp\":\"e\",\"id\":%" PRIu64 ",\"ts\":%.3f,\"pid\":1,\"tid\":%d}", name, e->id, ts, r->tid);
+        }
+        break;
+    case TRACE_YIELD:
+    case TRACE_FINISH:
+        fprintf(f, "%s{\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"event\":\"%s\"}}", sep, ts, r->tid, e->kind == TRACE_YIELD ? "yield" : "finish");
+        break;
+    case TRACE_SPAWN:
+        fprintf(f, "%s{\"name\":\"spawn %s #%" PRIu64 "\",\"cat\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}", sep, name, e->id, name, ts, r->tid);
+        fprintf(f, ",\n{\"name\":\"spawn\",\"cat\":\"%s\",\"ph\":\"s\",\"id\":%" PRIu64 ",\"ts\":%.3f,\"pid\":1,\"tid\":%d}", name, e->id, ts, r->tid);
+        break;
+    case TRACE_STEAL:
+        fprintf(f, "%s{\"name\":\"steal %s #%" PRIu64 "\",\"cat\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}", sep, name, e->id, name, ts, r->tid);
+        break;
+    }
+}
+
+// slices nest per thread, so a stack pairs them up. a wrapped ring lost the B of its oldest E's, and slices
+// still open at the stop have no E yet, both halves are left out of the file
+static void write_ring(FILE *f, const trace_ring_t *r, u32 *open, bool *skip, bool *first) {
+    u64 head = atomic_load_explicit(&r->head, memory_order_acquire);
+    u64 begin = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+    u32 depth = 0;
+    for (u64 i = begin; i < head; i++) {
+        u32 slot = (u32)(i % TRACE_RING_EVENTS);
+        u8 kind = r->entries[slot].kind;
+        skip[slot] = false;
+        if (opens_slice(kind)) {
+            open[depth++] = slot;
+        } else if (closes_slice(kind)) {
+            if (depth > 0) {
+                depth--;
+            } else {
+                skip[slot] = true;
+            }
+        }
+    }
+    while (depth > 0) {
+        skip[open[--depth]] = true;
+    }
+    for (u64 i = begin; i < head; i++) {
+        u32 slot = (u32)(i % TRACE_RING_EVENTS);
+        if (!skip[slot]) {
+            write_entry(f, r, &r->entries[slot], first);
+        }
+    }
+}
+
+void trace_stop(void) {
+    pthread_mutex_lock(&trace_mutex);
+    if (!atomic_load(&trace_enabled)) {
+        pthread_mutex_unlock(&trace_mutex);
+        return;
+    }
+    atomic_store(&trace_enabled, false);
+    // a producer that got past the enabled check before the store above finishes its event first
+    for (trace_ring_t *r = rings; r; r = r->next) {
+        while (atomic_load_explicit(&r->writing, memory_order_acquire)) {
+            sched_yield();
+        }
+    }
+
+    FILE *f = fopen(trace_path, "w");
+    if (f) {
+        u32 *open = malloc(TRACE_RING_EVENTS * sizeof(u32));
+        bool *skip = malloc(TRACE_RING_EVENTS * sizeof(bool));
+        assert(open && skip);
+        fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        bool first = true;
+        for (trace_ring_t *r = rings; r; r = r->next) {
+            write_ring(f, r, open, skip, &first);
+        }
+        fprintf(f, "\n]}\n");
+        fclose(f);
+        free(open);
+        free(skip);
+    } else {
+        perror("trace_stop");
+    }
+
+    free_exited_rings();
+    free(trace_path);
+    trace_path = NULL;
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+__attribute__((constructor)) static void trace_from_env(void) {
+    const char *path = getenv("SHEAF_TRACE");
+    if (path && path[0] != '\0') {
+        trace_start(path);
+    }
+}
+
+#else
+
+bool trace_start(const char *path) {
+    (void)path;
+    return false;
+}
+
+void trace_stop(void) {}
+
+u64 trace_next_id(void) { return 0; }
+
+void trace_record(trace_kind_t kind, trace_runtime_t runtime, u64 id) {
+    (void)kind;
+    (void)runtime;
+    (void)id;
+}
+
+#endif
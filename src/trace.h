@@ -0,0 +1,42 @@
+#pragma once
+
+#include "types.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// task lifecycle tracing into per-thread ring buffers, flushed as chrome trace-event json (open in ui.perfetto.dev).
+// only compiled in with SHEAF_TRACE (`scons trace=1`), and then only recorded between trace_start and trace_stop.
+// setting the SHEAF_TRACE environment variable to a path starts tracing before main.
+
+#define TRACE_RING_EVENTS (1 << 14) // per thread, oldest events are overwritten
+
+typedef enum { TRACE_SPAWN, TRACE_START, TRACE_YIELD, TRACE_RESUME, TRACE_FINISH, TRACE_STEAL } trace_kind_t;
+
+typedef enum { TRACE_GO, TRACE_ASYNC } trace_runtime_t;
+
+// false if tracing is compiled out or already running
+bool trace_start(const char *path);
+
+// stops recording, waits for events other threads are writing right now, then writes the json file and
+// frees the rings of threads that exited meanwhile. also called at exit
+void trace_stop(void);
+
+u64 trace_next_id(void);
+
+void trace_record(trace_kind_t kind, trace_runtime_t runtime, u64 id);
+
+#ifdef SHEAF_TRACE
+extern atomic_bool trace_enabled;
+
+// clang-format off
+#define trace_event(kind, runtime, id) \
+    do { \
+        if (__builtin_expect(atomic_load_explicit(&trace_enabled, memory_order_relaxed), 0)) { \
+            trace_record(kind, runtime, id); \
+        } \
+    } while (0)
+// clang-format on
+#else
+#define trace_event(kind, runtime, id) ((void)0)
+#endif
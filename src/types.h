@@ -67,6 +67,7 @@ typedef double f64;
 //
 
 typedef void (*fn_ptr)(void);
+typedef void (*env_fn_ptr)(void *env);
 
 //
 // assert 64-bit architecture
@@ -102,3 +103,4 @@ _Static_assert(sizeof(uintptr_t) == sizeof(u64), "");
 _Static_assert(sizeof(intptr_t) == sizeof(i64), "");
 _Static_assert(sizeof(void *) == sizeof(u64), "");
 _Static_assert(sizeof(fn_ptr) == sizeof(u64), "");
+_Static_assert(sizeof(env_fn_ptr) == sizeof(u64), "");
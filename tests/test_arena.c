@@ -0,0 +1,133 @@
+#include "../src/arena.h"
+#include "../src/async.h"
+#include "../src/go.h"
+#include "../src/types.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unity.h>
+
+static arena_t arena;
+static atomic_int test_counter = 0;
+static void *seen[2];
+
+void setUp(void) {
+    arena_init(&arena, 1024);
+    atomic_store(&test_counter, 0);
+}
+
+void tearDown(void) {
+    arena_destroy(&arena);
+    async_cleanup_all();
+}
+
+void test_arena_alignment(void) {
+    for (u64 size = 1; size < 100; size += 7) {
+        u8 *p = arena_alloc(&arena, size);
+        TEST_ASSERT_NOT_NULL(p);
+        TEST_ASSERT_EQUAL(0, (uintptr_t)p % ARENA_ALIGN);
+        memset(p, 0xab, size);
+    }
+}
+
+void test_arena_grows_and_fits_large(void) {
+    u8 *first = arena_alloc(&arena, 1000);
+    u8 *second = arena_alloc(&arena, 1000); // doesn't fit the first block anymore
+    u8 *large = arena_alloc(&arena, 10000); // bigger than a block, gets its own
+    memset(first, 1, 1000);
+    memset(second, 2, 1000);
+    memset(large, 3, 10000);
+    TEST_ASSERT_EQUAL(1, first[999]);
+    TEST_ASSERT_EQUAL(2, second[0]);
+    TEST_ASSERT_EQUAL(3, large[9999]);
+}
+
+static u8 *allocate_in_scope(u64 size) {
+    arena_scope(&arena);
+    u8 *p = arena_alloc(&arena, size);
+    memset(p, 0, size);
+    return p;
+}
+
+void test_arena_scope_rewinds(void) {
+    u8 *outer = arena_alloc(&arena, 64);
+
+    // once the scope exits the same memory is handed out again
+    u8 *a = allocate_in_scope(64);
+    u8 *b = allocate_in_scope(64);
+    TEST_ASSERT_TRUE(a == b);
+    TEST_ASSERT_TRUE(a > outer);
+
+    // rewinding across blocks keeps them as spares instead of freeing
+    u8 *big = allocate_in_scope(5000);
+    u8 *again = allocate_in_scope(5000);
+    TEST_ASSERT_TRUE(big == again);
+    TEST_ASSERT_TRUE(arena.head != NULL && arena.head->data == outer);
+    TEST_ASSERT_NOT_NULL(arena.spare);
+}
+
+void test_arena_rewind_to_empty(void) {
+    arena_mark_t empty = arena_mark(&arena);
+    u8 *p = arena_alloc(&arena, 32);
+    arena_rewind(&arena, empty);
+    TEST_ASSERT_NULL(arena.head);
+    TEST_ASSERT_TRUE(arena_alloc(&arena, 32) == p);
+}
+
+static void interleaved_task(void) {
+    arena_t *mine = arena_local();
+    arena_scope(mine);
+    u32 *value = arena_alloc(mine, sizeof(u32));
+    *value = (u32)atomic_fetch_add(&test_counter, 1);
+    seen[*value] = mine;
+    u32 expected = *value;
+    async_yield(); // the other coroutine allocates and rewinds in between
+    TEST_ASSERT_EQUAL(expected, *value);
+}
+
+void test_arena_per_coroutine(void) {
+    arena_t *outside = arena_local();
+    async_spawn(interleaved_task);
+    async_spawn(interleaved_task);
+    async_run_all();
+    TEST_ASSERT_EQUAL(2, atomic_load(&test_counter));
+    TEST_ASSERT_TRUE(seen[0] != seen[1]);
+    TEST_ASSERT_TRUE(seen[0] != outside);
+    TEST_ASSERT_TRUE(arena_local() == outside);
+}
+
+static void record_thread_arena(void *arg) {
+    arena_t **slot = *(arena_t ***)arg;
+    *slot = arena_local();
+    arena_scope(*slot);
+    TEST_ASSERT_NOT_NULL(arena_alloc(*slot, 128));
+}
+
+void test_arena_per_thread(void) {
+    go_shutdown();
+    go_init(2);
+    arena_t *arenas[16] = {0};
+    for (u32 i = 0; i < 16; i++) {
+        arena_t **slot = &arenas[i];
+        go_env(record_thread_arena, slot);
+    }
+    wait();
+    for (u32 i = 0; i < 16; i++) {
+        TEST_ASSERT_NOT_NULL(arenas[i]);
+        TEST_ASSERT_TRUE(arenas[i] != arena_local());
+    }
+    go_shutdown(); // worker arenas are released as the threads exit
+}
+
+i32 main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_arena_alignment);
+    RUN_TEST(test_arena_grows_and_fits_large);
+    RUN_TEST(test_arena_scope_rewinds);
+    RUN_TEST(test_arena_rewind_to_empty);
+    RUN_TEST(test_arena_per_coroutine);
+    RUN_TEST(test_arena_per_thread);
+
+    return UNITY_END();
+}
@@ -1,6 +1,7 @@
 #include "../src/async.h"
 #include "../src/types.h"
 #include <stdatomic.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <unistd.h>
 #include <unity.h>
@@ -45,6 +46,14 @@ void recursive_task(i32 depth) {
 
 void deep_recursion_task(void) { recursive_task(1000); }
 
+void stack_hungry_task(void) {
+    volatile u8 buffer[8192];
+    for (u32 i = 0; i < sizeof(buffer); i++) {
+        buffer[i] = (u8)i;
+    }
+    atomic_fetch_add(&test_counter, buffer[42]);
+}
+
 void test_async_spawn_single_thread(void) {
     async_spawn(simple_task);
     async_run_all();
@@ -81,6 +90,53 @@ void test_async_deep_recursion(void) {
     TEST_ASSERT_EQUAL(1, atomic_load(&test_counter));
 }
 
+typedef struct {
+    i32 amount;
+    u8 rounds;
+} add_env_t;
+
+static void add_rounds(void *arg) {
+    add_env_t *env = arg;
+    for (u8 i = 0; i < env->rounds; i++) {
+        atomic_fetch_add(&test_counter, env->amount);
+        async_yield();
+    }
+}
+
+void test_async_spawn_env(void) {
+    for (i32 i = 1; i <= 3; i++) {
+        async_env(add_rounds, (add_env_t){.amount = i, .rounds = 2});
+    }
+    async_run_all();
+    TEST_ASSERT_EQUAL(12, atomic_load(&test_counter));
+}
+
+void test_async_completed(void) {
+    u64 before = async_completed();
+    async_spawn(simple_task);
+    async_spawn(yield_task);
+    TEST_ASSERT_EQUAL(before, async_completed());
+    async_run_all();
+    TEST_ASSERT_EQUAL(before + 2, async_completed());
+}
+
+void test_async_descriptor_pool_steady_state(void) {
+    for (u32 i = 0; i < 10; i++) {
+        async_spawn(yield_task);
+    }
+    async_run_all();
+    u64 warm = async_descriptors_allocated();
+
+    for (u32 round = 0; round < 10; round++) {
+        for (u32 i = 0; i < 10; i++) {
+            async_spawn(i % 2 ? simple_task : yield_task);
+        }
+        async_run_all();
+    }
+    TEST_ASSERT_EQUAL(warm, async_descriptors_allocated());
+    TEST_ASSERT_EQUAL(50, atomic_load(&test_counter));
+}
+
 void test_async_cleanup(void) {
     async_spawn(simple_task);
     async_cleanup_all();
@@ -88,6 +144,112 @@ void test_async_cleanup(void) {
     TEST_ASSERT_EQUAL(0, atomic_load(&test_counter));
 }
 
+static bool is_readable(i32 fd) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
+void test_async_run_once_budget(void) {
+    async_spawn(yield_task);
+    async_spawn(simple_task);
+
+    TEST_ASSERT_EQUAL(1, async_run_once(1));
+    TEST_ASSERT_TRUE(atomic_load(&flags[0]));
+    TEST_ASSERT_FALSE(atomic_load(&flags[1]));
+    TEST_ASSERT_EQUAL(0, atomic_load(&test_counter));
+
+    TEST_ASSERT_EQUAL(2, async_run_once(5));
+    TEST_ASSERT_TRUE(atomic_load(&flags[1]));
+    TEST_ASSERT_EQUAL(1, atomic_load(&test_counter));
+
+    TEST_ASSERT_EQUAL(0, async_run_once(5));
+}
+
+void test_async_poll_fd(void) {
+    i32 fd = async_poll_fd();
+    TEST_ASSERT_TRUE(fd >= 0);
+    TEST_ASSERT_FALSE(is_readable(fd));
+
+    async_spawn(yield_task);
+    TEST_ASSERT_TRUE(is_readable(fd));
+
+    async_run_once(1);
+    TEST_ASSERT_TRUE(is_readable(fd));
+
+    async_run_once(1);
+    TEST_ASSERT_FALSE(is_readable(fd));
+    TEST_ASSERT_EQUAL(fd, async_poll_fd());
+}
+
+static void listener_task(void) {
+    while (!atomic_load(&flags[2])) {
+        async_yield();
+    }
+}
+
+void test_async_run_once_reuses_ids(void) {
+    // a long lived coroutine keeps the scheduler from ever draining, ids still have to come back
+    async_spawn(listener_task);
+    for (u32 i = 0; i < 1000; i++) {
+        async_spawn(simple_task);
+        async_run_once(4);
+    }
+    atomic_store(&flags[2], true);
+    while (async_run_once(16) > 0) {
+    }
+    TEST_ASSERT_EQUAL(1000, atomic_load(&test_counter));
+}
+
+void test_async_stack_stats(void) {
+    async_stack_stats_reset();
+    async_spawn(simple_task);
+    async_spawn(stack_hungry_task);
+    async_run_all();
+
+    async_stack_stats_t stats;
+    async_stack_stats(&stats);
+    TEST_ASSERT_TRUE(stats.stack_size > 0);
+#ifdef SHEAF_STATS
+    TEST_ASSERT_EQUAL(2, stats.samples);
+    TEST_ASSERT_TRUE(stats.used[0] > 0);
+    TEST_ASSERT_TRUE(stats.used[1] > stats.used[0]);
+    TEST_ASSERT_TRUE(stats.used[1] >= 8192);
+    TEST_ASSERT_EQUAL(stats.used[1], stats.max_used);
+    TEST_ASSERT_TRUE(stats.max_used <= stats.stack_size);
+
+    u64 total = 0;
+    for (u8 i = 0; i < ASYNC_STACK_BUCKETS; i++) {
+        total += stats.histogram[i];
+    }
+    TEST_ASSERT_EQUAL(2, total);
+#else
+    TEST_ASSERT_EQUAL(0, stats.samples);
+    TEST_ASSERT_EQUAL(0, stats.max_used);
+#endif
+}
+
+void test_async_sched_stats(void) {
+    async_sched_stats_reset();
+    async_spawn(yield_task);
+    async_spawn(stack_hungry_task);
+    async_run_all();
+
+    async_sched_stats_t stats;
+    async_sched_stats(&stats);
+#ifdef SHEAF_STATS
+    TEST_ASSERT_EQUAL(3, stats.switches);
+    TEST_ASSERT_EQUAL(1, stats.threads[0].yields);
+    TEST_ASSERT_EQUAL(0, stats.threads[1].yields);
+    TEST_ASSERT_TRUE(stats.threads[0].run_ns + stats.threads[1].run_ns == stats.busy_ns);
+    TEST_ASSERT_TRUE(stats.threads[0].wait_ns > 0);
+    TEST_ASSERT_TRUE(stats.longest_slice_ns <= stats.busy_ns);
+    TEST_ASSERT_TRUE(stats.busy_ns <= stats.elapsed_ns);
+#else
+    TEST_ASSERT_EQUAL(0, stats.switches);
+    TEST_ASSERT_EQUAL(0, stats.busy_ns);
+#endif
+}
+
 i32 main(void) {
     UNITY_BEGIN();
 
@@ -96,7 +258,15 @@ i32 main(void) {
     RUN_TEST(test_async_yield);
     RUN_TEST(test_async_thread_interaction);
     RUN_TEST(test_async_deep_recursion);
+    RUN_TEST(test_async_spawn_env);
+    RUN_TEST(test_async_completed);
+    RUN_TEST(test_async_descriptor_pool_steady_state);
     RUN_TEST(test_async_cleanup);
+    RUN_TEST(test_async_run_once_budget);
+    RUN_TEST(test_async_poll_fd);
+    RUN_TEST(test_async_run_once_reuses_ids);
+    RUN_TEST(test_async_stack_stats);
+    RUN_TEST(test_async_sched_stats);
 
     return UNITY_END();
 }
@@ -0,0 +1,137 @@
+#include "../src/benchmark.h"
+#include "../src/types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <unity.h>
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_benchmark_summarize_basic(void) {
+    f64 samples[] = {5.0, 1.0, 3.0, 2.0, 4.0};
+    benchmark_result_t r = benchmark_summarize("basic", samples, 5, 1);
+
+    TEST_ASSERT_EQUAL(5, r.samples);
+    TEST_ASSERT_EQUAL(0, r.outliers);
+    TEST_ASSERT_FLOAT_WITHIN(1e-9, 1.0, r.min);
+    TEST_ASSERT_FLOAT_WITHIN(1e-9, 5.0, r.max);
+    TEST_ASSERT_FLOAT_WITHIN(1e-9, 3.0, r.median);
+    TEST_ASSERT_FLOAT_WITHIN(1e-9, 3.0, r.mean);
+    TEST_ASSERT_FLOAT_WITHIN(1e-9, 5.0, r.p99);
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, 1.581139, r.stddev);
+}
+
+void test_benchmark_summarize_rejects_outliers(void) {
+    f64 samples[] = {1.0, 1.1, 0.9, 1.0, 1.05, 0.95, 1.0, 50.0};
+    benchmark_result_t r = benchmark_summarize("outliers", samples, 8, 1);
+
+    TEST_ASSERT_EQUAL(7, r.samples);
+    TEST_ASSERT_EQUAL(1, r.outliers);
+    TEST_ASSERT_FLOAT_WITHIN(1e-9, 50.0, r.max); // reported, just kept out of the mean
+    TEST_ASSERT_FLOAT_WITHIN(1e-9, 1.0, r.median);
+    TEST_ASSERT_FLOAT_WITHIN(1e-9, 1.0, r.mean);
+    TEST_ASSERT_TRUE(r.stddev < 0.1);
+}
+
+void test_benchmark_stats_fixed_iterations(void) {
+    volatile u64 sink = 0;
+    benchmark_opts_t opts = {.warmup = 1, .iterations = 20, .target_seconds = 0.0};
+    benchmark_result_t r = benchmark_stats("loop", opts, {
+        for (u32 i = 0; i < 1000; i++) {
+            sink += i;
+        }
+    });
+
+    TEST_ASSERT_EQUAL(20, r.samples + r.outliers);
+    TEST_ASSERT_TRUE(r.batch >= 1);
+    TEST_ASSERT_TRUE(r.min > 0.0);
+    TEST_ASSERT_TRUE(r.min <= r.median);
+    TEST_ASSERT_TRUE(r.median <= r.p99);
+    TEST_ASSERT_TRUE(r.p99 <= r.max);
+}
+
+void test_benchmark_write_formats(void) {
+    f64 samples[] = {1e-6, 2e-6, 3e-6};
+    benchmark_result_t r = benchmark_summarize("fmt", samples, 3, 1);
+
+    char buffer[1024] = {0};
+    FILE *f = fmemopen(buffer, sizeof(buffer), "w");
+    benchmark_write_json(f, &r, 1);
+    fclose(f);
+    TEST_ASSERT_NOT_NULL(strstr(buffer, "\"name\": \"fmt\""));
+    TEST_ASSERT_NOT_NULL(strstr(buffer, "\"median_ns\": 2000.0"));
+
+    memset(buffer, 0, sizeof(buffer));
+    f = fmemopen(buffer, sizeof(buffer), "w");
+    benchmark_write_csv(f, &r, 1);
+    fclose(f);
+    TEST_ASSERT_NOT_NULL(strstr(buffer, "fmt,3,0,1,1000.0,2000.0"));
+}
+
+void test_benchmark_record(void) {
+    static benchmark_results_t recorded;
+    f64 samples[] = {1e-6, 2e-6, 3e-6};
+    for (u32 i = 0; i < 2; i++) {
+        benchmark_record(&recorded, benchmark_summarize("", samples, 3, 1), "spawn/workers=%u", i + 1);
+    }
+    TEST_ASSERT_EQUAL(2, recorded.count);
+    TEST_ASSERT_EQUAL_STRING("spawn/workers=1", recorded.results[0].name);
+    TEST_ASSERT_EQUAL_STRING("spawn/workers=2", recorded.results[1].name);
+    TEST_ASSERT_EQUAL(3, recorded.results[1].samples);
+}
+
+void test_benchmark_counters_degrade(void) {
+    volatile u64 sink = 0;
+    benchmark_opts_t opts = {.warmup = 1, .iterations = 5, .target_seconds = 0.0, .counters = true};
+    benchmark_result_t r = benchmark_stats("counted", opts, {
+        for (u32 i = 0; i < 1000; i++) {
+            sink += i;
+        }
+    });
+
+    // timing works whether or not the kernel lets us count
+    TEST_ASSERT_EQUAL(5, r.samples + r.outliers);
+    TEST_ASSERT_TRUE(r.median > 0.0);
+    for (u32 c = 0; c < BENCHMARK_COUNTERS; c++) {
+        TEST_ASSERT_TRUE(r.counters.valid[c] || r.counters.value[c] == 0.0);
+    }
+    if (r.counters.valid[BENCHMARK_INSTRUCTIONS]) {
+        TEST_ASSERT_TRUE(r.counters.value[BENCHMARK_INSTRUCTIONS] > 1000.0);
+    }
+}
+
+void test_benchmark_compare_baseline(void) {
+    f64 fast[] = {1e-6, 1e-6, 1e-6};
+    f64 slow[] = {2e-6, 2e-6, 2e-6};
+    benchmark_result_t before[] = {benchmark_summarize("a", fast, 3, 1), benchmark_summarize("b", fast, 3, 1)};
+    benchmark_result_t after[] = {benchmark_summarize("a", fast, 3, 1), benchmark_summarize("b", slow, 3, 1), benchmark_summarize("new", slow, 3, 1)};
+
+    char path[] = "/tmp/sheaf_baseline_XXXXXX";
+    i32 fd = mkstemp(path);
+    TEST_ASSERT_TRUE(fd >= 0);
+    FILE *f = fdopen(fd, "w");
+    benchmark_write_json(f, before, 2);
+    fclose(f);
+
+    TEST_ASSERT_EQUAL(0, benchmark_compare_baseline(path, before, 2, 0.10));
+    TEST_ASSERT_EQUAL(1, benchmark_compare_baseline(path, after, 3, 0.10));
+    TEST_ASSERT_EQUAL(0, benchmark_compare_baseline(path, after, 3, 1.5));
+    unlink(path);
+}
+
+i32 main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_benchmark_summarize_basic);
+    RUN_TEST(test_benchmark_summarize_rejects_outliers);
+    RUN_TEST(test_benchmark_stats_fixed_iterations);
+    RUN_TEST(test_benchmark_write_formats);
+    RUN_TEST(test_benchmark_record);
+    RUN_TEST(test_benchmark_counters_degrade);
+    RUN_TEST(test_benchmark_compare_baseline);
+
+    return UNITY_END();
+}
@@ -0,0 +1,220 @@
+#include "../src/async.h"
+#include "../src/cancel.h"
+#include "../src/clock.h"
+#include "../src/go.h"
+#include "../src/types.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <unity.h>
+
+static cancel_token_t token;
+static atomic_int test_counter = 0;
+static atomic_bool release = false;
+static atomic_bool blocker_started = false;
+
+void setUp(void) {
+    cancel_init(&token, NULL);
+    atomic_store(&test_counter, 0);
+    atomic_store(&release, false);
+    atomic_store(&blocker_started, false);
+}
+
+void tearDown(void) {
+    atomic_store(&release, true);
+    wait();
+    async_cleanup_all();
+}
+
+void test_cancel_parent_chain(void) {
+    cancel_token_t child, grandchild;
+    cancel_init(&child, &token);
+    cancel_init(&grandchild, &child);
+    TEST_ASSERT_FALSE(cancel_requested(&grandchild));
+    cancel(&token);
+    TEST_ASSERT_TRUE(cancel_status(&grandchild) == CANCEL_CANCELLED);
+    TEST_ASSERT_FALSE(cancel_requested(NULL));
+
+    cancel_token_t timed;
+    cancel_init_timeout(&timed, NULL, 1000 * 1000);
+    TEST_ASSERT_TRUE(cancel_status(&timed) == CANCEL_OK);
+    usleep(2000);
+    TEST_ASSERT_TRUE(cancel_status(&timed) == CANCEL_EXPIRED);
+}
+
+static void block_worker(void) {
+    atomic_store(&blocker_started, true);
+    while (!atomic_load(&release)) {
+        usleep(100);
+    }
+}
+
+// occupies the only worker so everything spawned next stays queued
+static void occupy_single_worker(void) {
+    go_shutdown();
+    go_init(1);
+    spawn(block_worker);
+    while (!atomic_load(&blocker_started)) {
+        usleep(100);
+    }
+}
+
+static void count(void) { atomic_fetch_add(&test_counter, 1); }
+
+static void spawn_under_token(u32 n) {
+    cancel_scope(&token);
+    for (u32 i = 0; i < n; i++) {
+        spawn(count);
+    }
+}
+
+void test_cancel_drops_queued_goroutines(void) {
+    occupy_single_worker();
+    spawn_under_token(10);
+    spawn(count); // outside the scope, not affected
+    cancel(&token);
+    atomic_store(&release, true);
+    wait();
+    TEST_ASSERT_EQUAL(1, atomic_load(&test_counter));
+    TEST_ASSERT_NULL(cancel_current());
+}
+
+static void parent_task(void) {
+    for (u32 i = 0; i < 5; i++) {
+        spawn(count); // inherits the parent's token
+    }
+    cancel(&token);
+    atomic_fetch_add(&test_counter, 100);
+}
+
+void test_cancel_propagates_to_children(void) {
+    go_shutdown();
+    go_init(1);
+    {
+        cancel_scope(&token);
+        spawn(parent_task);
+    }
+    wait();
+    // a single worker, so the children were still queued when the parent cancelled
+    TEST_ASSERT_EQUAL(100, atomic_load(&test_counter));
+}
+
+static atomic_int sleep_status = -1;
+static atomic_ullong slept_ns = 0;
+
+static void long_sleep(void) {
+    u64 start = clock_ns();
+    atomic_store(&sleep_status, cancel_sleep(5ull * 1000 * 1000 * 1000));
+    atomic_store(&slept_ns, clock_ns() - start);
+}
+
+void test_cancel_wakes_sleepers(void) {
+    go_shutdown();
+    go_init(2);
+    {
+        cancel_scope(&token);
+        spawn(long_sleep);
+    }
+    usleep(10 * 1000);
+    cancel(&token);
+    wait();
+    TEST_ASSERT_EQUAL(CANCEL_CANCELLED, atomic_load(&sleep_status));
+    TEST_ASSERT_TRUE(atomic_load(&slept_ns) < 1000ull * 1000 * 1000);
+
+    cancel_token_t timed;
+    cancel_init_timeout(&timed, NULL, 20 * 1000 * 1000);
+    u64 start = clock_ns();
+    cancel_status_t status;
+    {
+        cancel_scope(&timed);
+        status = cancel_sleep(5ull * 1000 * 1000 * 1000);
+    }
+    u64 elapsed = clock_ns() - start;
+    TEST_ASSERT_EQUAL(CANCEL_EXPIRED, status);
+    TEST_ASSERT_TRUE(elapsed >= 15 * 1000 * 1000 && elapsed < 1000ull * 1000 * 1000);
+    TEST_ASSERT_TRUE(cancel_sleep(1000) == CANCEL_OK); // no token outside the scope
+}
+
+static void *cancel_later(void *arg) {
+    (void)arg;
+    usleep(20 * 1000);
+    cancel(&token);
+    return NULL;
+}
+
+void test_cancel_wakes_blocked_spawner(void) {
+    // the only worker is busy and the single queue slot taken, so the next spawn blocks for room
+    go_shutdown();
+    go_init_config(&(go_config_t){.workers = 1, .queue_limit = 1, .overflow = GO_OVERFLOW_BLOCK});
+    spawn(block_worker);
+    while (!atomic_load(&blocker_started)) {
+        usleep(100);
+    }
+    TEST_ASSERT_TRUE(spawn(count) == GO_SPAWNED);
+    pthread_t canceller;
+    TEST_ASSERT_EQUAL(0, pthread_create(&canceller, NULL, cancel_later, NULL));
+    go_spawn_t spawned;
+    u64 start = clock_ns();
+    {
+        cancel_scope(&token);
+        spawned = spawn(count);
+        TEST_ASSERT_TRUE(spawn(count) == GO_CANCELLED); // cancelled already, doesn't wait at all
+    }
+    u64 elapsed = clock_ns() - start;
+    pthread_join(canceller, NULL);
+    TEST_ASSERT_TRUE(spawned == GO_CANCELLED);
+    TEST_ASSERT_TRUE(elapsed >= 15 * 1000 * 1000 && elapsed < 1000ull * 1000 * 1000); // blocked until the cancel
+    atomic_store(&release, true);
+    wait();
+    TEST_ASSERT_EQUAL(1, atomic_load(&test_counter)); // only the one queued before
+    go_shutdown();
+    go_init(0);
+}
+
+static void polling_coroutine(void) {
+    while (!cancelled()) {
+        atomic_fetch_add(&test_counter, 1);
+        async_yield();
+    }
+}
+
+static void cancelling_coroutine(void) {
+    async_yield();
+    async_yield();
+    cancel(&token);
+}
+
+void test_cancel_async(void) {
+    {
+        cancel_scope(&token);
+        async_spawn(polling_coroutine);
+    }
+    async_spawn(cancelling_coroutine); // not attached, keeps running after the cancel
+    async_run_all();
+    TEST_ASSERT_EQUAL(3, atomic_load(&test_counter));
+
+    // cancelled before the loop ever ran them
+    atomic_store(&test_counter, 0);
+    {
+        cancel_scope(&token);
+        async_spawn(count);
+        async_spawn(count);
+    }
+    async_spawn(count);
+    async_run_all();
+    TEST_ASSERT_EQUAL(1, atomic_load(&test_counter));
+}
+
+i32 main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_cancel_parent_chain);
+    RUN_TEST(test_cancel_drops_queued_goroutines);
+    RUN_TEST(test_cancel_propagates_to_children);
+    RUN_TEST(test_cancel_wakes_sleepers);
+    RUN_TEST(test_cancel_wakes_blocked_spawner);
+    RUN_TEST(test_cancel_async);
+
+    return UNITY_END();
+}
@@ -0,0 +1,65 @@
+#include "../src/clock.h"
+#include "../src/types.h"
+#include <stdbool.h>
+#include <unistd.h>
+#include <unity.h>
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_clock_is_monotonic(void) {
+    u64 last = clock_ns();
+    for (u32 i = 0; i < 100000; i++) {
+        u64 now = i % 2 ? clock_ns() : clock_ns_ordered();
+        TEST_ASSERT_TRUE(now >= last);
+        last = now;
+    }
+}
+
+void test_clock_conversion(void) {
+    TEST_ASSERT_TRUE(clock_source.ticks_per_sec > 0);
+    // one second worth of ticks converts back to one second, up to fixed point rounding
+    u64 second = clock_ticks_to_ns(clock_source.ticks_per_sec);
+    TEST_ASSERT_TRUE(second >= 1000000000ULL - 10 && second <= 1000000000ULL);
+    if (!clock_source.cycle_counter) {
+        TEST_ASSERT_EQUAL(12345, clock_ticks_to_ns(12345));
+    }
+}
+
+void test_clock_agrees_with_gettime(void) {
+    u64 start = clock_ns();
+    u64 start_reference = clock_gettime_ns();
+    usleep(50000);
+    u64 elapsed = clock_ns_ordered() - start;
+    u64 elapsed_reference = clock_gettime_ns() - start_reference;
+
+    TEST_ASSERT_TRUE(elapsed >= 50000000ULL);
+    // within 1% plus a little slack for the reads themselves
+    u64 diff = elapsed > elapsed_reference ? elapsed - elapsed_reference : elapsed_reference - elapsed;
+    TEST_ASSERT_TRUE(diff < elapsed_reference / 100 + 100000);
+}
+
+void test_clock_resolution(void) {
+    // back to back reads must be able to tell apart an interval well under a microsecond
+    u64 smallest = UINT64_MAX;
+    for (u32 i = 0; i < 1000; i++) {
+        u64 a = clock_ns();
+        u64 b = clock_ns();
+        if (b > a && b - a < smallest) {
+            smallest = b - a;
+        }
+    }
+    TEST_ASSERT_TRUE(smallest < 1000);
+}
+
+i32 main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_clock_is_monotonic);
+    RUN_TEST(test_clock_conversion);
+    RUN_TEST(test_clock_agrees_with_gettime);
+    RUN_TEST(test_clock_resolution);
+
+    return UNITY_END();
+}
@@ -1,7 +1,11 @@
+#define _GNU_SOURCE
+#include "../src/clock.h"
 #include "../src/go.h"
 #include "../src/types.h"
 #include <float.h>
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <time.h>
@@ -135,6 +139,40 @@ void test_go_race_condition_safety(void) {
     TEST_ASSERT_EQUAL(num_increments, atomic_load(&test_counter));
 }
 
+typedef struct {
+    u32 index;
+    i32 value;
+    atomic_int *out;
+} slot_env_t;
+
+static void store_slot(void *arg) {
+    slot_env_t *env = arg;
+    atomic_store(&env->out[env->index], env->value);
+}
+
+static void count_call(void *arg) {
+    (void)arg;
+    atomic_fetch_add(&test_counter, 1);
+}
+
+void test_go_env_capture(void) {
+    atomic_int results[10];
+    for (u32 i = 0; i < 10; i++) {
+        atomic_store(&results[i], -1);
+    }
+    // every goroutine keeps its own copy of the loop variable
+    for (u32 i = 0; i < 10; i++) {
+        go_env(store_slot, (slot_env_t){.index = i, .value = (i32)(i * i), .out = results});
+    }
+    spawn_env(count_call, NULL, 0);
+    wait();
+
+    for (u32 i = 0; i < 10; i++) {
+        TEST_ASSERT_EQUAL(i * i, atomic_load(&results[i]));
+    }
+    TEST_ASSERT_EQUAL(1, atomic_load(&test_counter));
+}
+
 void test_go_sequential_wait_calls(void) {
     go({ atomic_fetch_add(&test_counter, 1); });
 
@@ -191,6 +229,500 @@ void test_go_large_number_of_goroutines(void) {
     TEST_ASSERT_EQUAL(num_goroutines, atomic_load(&test_counter));
 }
 
+void test_go_worker_pool_restart(void) {
+    go_shutdown();
+    TEST_ASSERT_EQUAL(0, go_worker_count());
+
+    go_init(3);
+    TEST_ASSERT_EQUAL(3, go_worker_count());
+
+    for (i32 i = 0; i < 20; i++) {
+        go({ atomic_fetch_add(&test_counter, 1); });
+    }
+    wait();
+    TEST_ASSERT_EQUAL(20, atomic_load(&test_counter));
+
+    go_shutdown();
+    go({ atomic_fetch_add(&test_counter, 1); });
+    wait();
+    TEST_ASSERT_EQUAL(21, atomic_load(&test_counter));
+    TEST_ASSERT_TRUE(go_worker_count() > 0);
+}
+
+void test_go_stats(void) {
+    go_shutdown();
+    go_init(2);
+    go_stats_reset();
+
+    const i32 num_goroutines = 40;
+    for (i32 i = 0; i < num_goroutines; i++) {
+        go({
+            atomic_fetch_add(&test_counter, 1);
+            usleep(100);
+        });
+    }
+    wait();
+
+    go_stats_t stats;
+    go_stats(&stats);
+    TEST_ASSERT_EQUAL(2, stats.workers);
+    TEST_ASSERT_EQUAL(0, stats.queue_depth);
+#ifdef SHEAF_STATS
+    u64 tasks = 0, latencies = 0;
+    for (u32 i = 0; i < stats.workers; i++) {
+        tasks += stats.worker[i].tasks;
+        TEST_ASSERT_TRUE(stats.worker[i].tasks == 0 || stats.worker[i].busy_ns > 0);
+    }
+    for (u32 i = 0; i < GO_LATENCY_BUCKETS; i++) {
+        latencies += stats.latency[i];
+    }
+    TEST_ASSERT_EQUAL(num_goroutines, tasks);
+    TEST_ASSERT_EQUAL(num_goroutines, latencies);
+    TEST_ASSERT_TRUE(stats.max_queue_depth > 0);
+#else
+    TEST_ASSERT_EQUAL(0, stats.worker[0].tasks);
+#endif
+}
+
+void test_go_completed_survives_restart(void) {
+    u64 before = go_completed();
+    for (i32 i = 0; i < 30; i++) {
+        go({ atomic_fetch_add(&test_counter, 1); });
+    }
+    wait();
+    TEST_ASSERT_EQUAL(before + 30, go_completed());
+
+    // counts of joined workers are kept when the pool restarts
+    go_shutdown();
+    TEST_ASSERT_EQUAL(before + 30, go_completed());
+    go_init(2);
+    go({ atomic_fetch_add(&test_counter, 1); });
+    wait();
+    TEST_ASSERT_EQUAL(before + 31, go_completed());
+}
+
+static atomic_bool blocker_started = false;
+
+static void block_worker(void) {
+    atomic_store(&blocker_started, true);
+    while (!atomic_load(&test_flag)) {
+        usleep(100);
+    }
+}
+
+static void spawn_children(void) {
+    for (u32 i = 0; i < 8; i++) {
+        go({ atomic_fetch_add(&test_counter, 1); });
+    }
+}
+
+static void spawn_round(void) {
+    // the worker is held until everything is queued, so every round peaks at the same descriptors in flight
+    atomic_store(&test_flag, false);
+    atomic_store(&blocker_started, false);
+    spawn(block_worker);
+    while (!atomic_load(&blocker_started)) {
+        usleep(100);
+    }
+    for (u32 i = 0; i < 500; i++) {
+        go({ atomic_fetch_add(&test_counter, 1); });
+    }
+    for (u32 i = 0; i < 20; i++) {
+        spawn(spawn_children);
+    }
+    atomic_store(&test_flag, true);
+    wait(); // descriptors go back to their pools before the goroutines count as done
+}
+
+void test_go_descriptor_pool_steady_state(void) {
+    // a single worker, so the nested spawns always come out of the same worker pool
+    go_shutdown();
+    go_init(1);
+    for (u32 round = 0; round < 2; round++) {
+        spawn_round(); // warms the pools of this thread and the worker
+    }
+    go_stats_t stats;
+    go_stats(&stats);
+    u64 warm = stats.descriptors_allocated;
+
+    for (u32 round = 0; round < 10; round++) {
+        spawn_round();
+    }
+    go_stats(&stats);
+    TEST_ASSERT_EQUAL(warm, stats.descriptors_allocated);
+    TEST_ASSERT_EQUAL(12 * (500 + 20 * 8), atomic_load(&test_counter));
+}
+
+static void wait_for_children(void) {
+    for (u32 i = 0; i < 10; i++) {
+        go({
+            usleep(100);
+            atomic_fetch_add(&test_counter, 1);
+        });
+    }
+    wait(); // joins only the ten above, running them here if no other worker took them
+    TEST_ASSERT_EQUAL(10, atomic_load(&test_counter) % 100);
+    atomic_fetch_add(&test_counter, 100 - 10);
+}
+
+void test_go_wait_inside_goroutine(void) {
+    // a single worker: blocking it in wait() would deadlock, helping runs the children in place
+    go_shutdown();
+    go_init(1);
+    spawn(wait_for_children);
+    wait();
+    TEST_ASSERT_EQUAL(100, atomic_load(&test_counter));
+}
+
+typedef struct {
+    u32 n;
+    u64 *out;
+} fib_env_t;
+
+static void fib(void *arg) {
+    fib_env_t *env = arg;
+    if (env->n < 2) {
+        *env->out = env->n;
+        return;
+    }
+    u64 a = 0, b = 0;
+    task_group_t tg = TASK_GROUP_INIT;
+    task_group_go_env(&tg, fib, (fib_env_t){.n = env->n - 1, .out = &a});
+    task_group_go_env(&tg, fib, (fib_env_t){.n = env->n - 2, .out = &b});
+    task_group_wait(&tg);
+    *env->out = a + b;
+}
+
+void test_go_task_group_recursive(void) {
+    u64 result = 0;
+    for (u32 workers = 1; workers <= 4; workers *= 2) {
+        go_shutdown();
+        go_init(workers);
+        task_group_t tg = TASK_GROUP_INIT;
+        task_group_go_env(&tg, fib, (fib_env_t){.n = 18, .out = &result});
+        task_group_wait(&tg);
+        TEST_ASSERT_EQUAL(2584, result);
+        TEST_ASSERT_EQUAL(0, atomic_load(&tg.pending));
+    }
+}
+
+static void record_cpu(void) { atomic_store(&execution_order[atomic_fetch_add(&execution_index, 1) % 10], sched_getcpu()); }
+
+void test_go_affinity_cpuset(void) {
+    cpu_set_t allowed;
+    TEST_ASSERT_EQUAL(0, sched_getaffinity(0, sizeof(allowed), &allowed));
+    u32 cpu = 0;
+    while (!CPU_ISSET(cpu, &allowed)) {
+        cpu++;
+    }
+
+    go_shutdown();
+    go_init_config(&(go_config_t){.workers = 2, .affinity = GO_AFFINITY_CPUSET, .cpus = &cpu, .cpu_count = 1});
+    TEST_ASSERT_EQUAL((i32)cpu, go_worker_cpu(0));
+    TEST_ASSERT_EQUAL((i32)cpu, go_worker_cpu(1));
+    for (u32 i = 0; i < 10; i++) {
+        spawn(record_cpu);
+    }
+    wait();
+    for (u32 i = 0; i < 10; i++) {
+        TEST_ASSERT_EQUAL((i32)cpu, atomic_load(&execution_order[i]));
+    }
+    go_shutdown();
+}
+
+void test_go_affinity_compact(void) {
+    cpu_set_t allowed;
+    TEST_ASSERT_EQUAL(0, sched_getaffinity(0, sizeof(allowed), &allowed));
+
+    go_shutdown();
+    go_init_config(&(go_config_t){.affinity = GO_AFFINITY_COMPACT});
+    TEST_ASSERT_EQUAL(CPU_COUNT(&allowed), go_worker_count());
+    cpu_set_t used;
+    CPU_ZERO(&used);
+    for (u32 i = 0; i < go_worker_count(); i++) {
+        i32 cpu = go_worker_cpu(i);
+        TEST_ASSERT_TRUE(cpu >= 0 && CPU_ISSET((u32)cpu, &allowed));
+        CPU_SET((u32)cpu, &used);
+    }
+    // one worker per allowed cpu, none doubled up
+    TEST_ASSERT_EQUAL(CPU_COUNT(&allowed), CPU_COUNT(&used));
+
+    go({ atomic_fetch_add(&test_counter, 1); });
+    wait();
+    TEST_ASSERT_EQUAL(1, atomic_load(&test_counter));
+    go_shutdown();
+    TEST_ASSERT_EQUAL(-1, go_worker_cpu(0));
+}
+
+// occupies the only worker so everything spawned next queues up behind it
+static void occupy_single_worker(void) {
+    go_shutdown();
+    go_init(1);
+    atomic_store(&blocker_started, false);
+    spawn(block_worker);
+    while (!atomic_load(&blocker_started)) {
+        usleep(100);
+    }
+}
+
+static void record_order(void *arg) { atomic_store(&execution_order[atomic_fetch_add(&execution_index, 1)], *(i32 *)arg); }
+
+void test_go_priority_order(void) {
+    occupy_single_worker();
+    go_env_priority(GO_PRIORITY_BACKGROUND, record_order, (i32)GO_PRIORITY_BACKGROUND);
+    go_env_priority(GO_PRIORITY_NORMAL, record_order, (i32)GO_PRIORITY_NORMAL);
+    go_env_priority(GO_PRIORITY_HIGH, record_order, (i32)GO_PRIORITY_HIGH);
+    atomic_store(&test_flag, true);
+    wait();
+    TEST_ASSERT_EQUAL(3, atomic_load(&execution_index));
+    TEST_ASSERT_EQUAL(GO_PRIORITY_HIGH, atomic_load(&execution_order[0]));
+    TEST_ASSERT_EQUAL(GO_PRIORITY_NORMAL, atomic_load(&execution_order[1]));
+    TEST_ASSERT_EQUAL(GO_PRIORITY_BACKGROUND, atomic_load(&execution_order[2]));
+}
+
+static atomic_int background_ran_after = -1;
+
+static void high_chain(void) {
+    usleep(1000);
+    if (atomic_fetch_add(&test_counter, 1) < 60) {
+        spawn(high_chain); // inherits high priority
+    }
+}
+
+static void background_task(void) { atomic_store(&background_ran_after, atomic_load(&test_counter)); }
+
+void test_go_priority_aging(void) {
+    occupy_single_worker();
+    atomic_store(&background_ran_after, -1);
+    spawn_priority(GO_PRIORITY_BACKGROUND, background_task);
+    spawn_priority(GO_PRIORITY_HIGH, high_chain);
+    atomic_store(&test_flag, true);
+    wait();
+    // high priority work never runs dry, still the background goroutine gets its turn once it aged
+    i32 ran_after = atomic_load(&background_ran_after);
+    TEST_ASSERT_TRUE(ran_after >= 0);
+    TEST_ASSERT_TRUE(ran_after < 60);
+}
+
+static void occupy_bounded_worker(go_overflow_t overflow) {
+    go_shutdown();
+    go_init_config(&(go_config_t){.workers = 1, .queue_limit = 4, .overflow = overflow});
+    atomic_store(&blocker_started, false);
+    spawn(block_worker);
+    while (!atomic_load(&blocker_started)) {
+        usleep(100);
+    }
+}
+
+static void bump_counter(void) { atomic_fetch_add(&test_counter, 1); }
+
+void test_go_bounded_reject(void) {
+    occupy_bounded_worker(GO_OVERFLOW_REJECT);
+    go_stats_t before, after;
+    go_stats(&before);
+    for (u32 i = 0; i < 4; i++) {
+        TEST_ASSERT_TRUE(spawn(bump_counter) == GO_SPAWNED);
+    }
+    TEST_ASSERT_TRUE(spawn(bump_counter) == GO_REJECTED);
+    atomic_store(&test_flag, true);
+    wait();
+    go_stats(&after);
+    TEST_ASSERT_EQUAL(4, atomic_load(&test_counter));
+    TEST_ASSERT_EQUAL(1, after.rejected - before.rejected);
+    TEST_ASSERT_TRUE(spawn(bump_counter) == GO_SPAWNED); // room again once drained
+    wait();
+}
+
+void test_go_bounded_inline(void) {
+    occupy_bounded_worker(GO_OVERFLOW_INLINE);
+    for (u32 i = 0; i < 4; i++) {
+        spawn(bump_counter);
+    }
+    TEST_ASSERT_TRUE(spawn(bump_counter) == GO_RAN_INLINE);
+    TEST_ASSERT_EQUAL(1, atomic_load(&test_counter)); // ran on this thread while the worker is still busy
+    atomic_store(&test_flag, true);
+    wait();
+    TEST_ASSERT_EQUAL(5, atomic_load(&test_counter));
+}
+
+static atomic_int spawns_returned = 0;
+
+static void *spawn_six(void *arg) {
+    (void)arg;
+    for (u32 i = 0; i < 6; i++) {
+        if (spawn(bump_counter) == GO_SPAWNED) {
+            atomic_fetch_add(&spawns_returned, 1);
+        }
+    }
+    return NULL;
+}
+
+void test_go_bounded_block(void) {
+    occupy_bounded_worker(GO_OVERFLOW_BLOCK);
+    atomic_store(&spawns_returned, 0);
+    pthread_t submitter;
+    TEST_ASSERT_EQUAL(0, pthread_create(&submitter, NULL, spawn_six, NULL));
+    usleep(20 * 1000);
+    TEST_ASSERT_EQUAL(4, atomic_load(&spawns_returned)); // the fifth waits for room
+    atomic_store(&test_flag, true);
+    TEST_ASSERT_EQUAL(0, pthread_join(submitter, NULL));
+    TEST_ASSERT_EQUAL(6, atomic_load(&spawns_returned));
+    wait();
+    TEST_ASSERT_EQUAL(6, atomic_load(&test_counter));
+    go_shutdown();
+}
+
+void test_go_spawn_batch(void) {
+    static atomic_int results[1000];
+    static slot_env_t envs[1000];
+    for (u32 i = 0; i < 1000; i++) {
+        atomic_store(&results[i], -1);
+        envs[i] = (slot_env_t){.index = i, .value = (i32)i, .out = results};
+    }
+    TEST_ASSERT_EQUAL(1000, go_batch(store_slot, envs, 1000));
+    wait();
+    for (u32 i = 0; i < 1000; i++) {
+        TEST_ASSERT_EQUAL(i, atomic_load(&results[i]));
+    }
+}
+
+static void batch_children(void) {
+    spawn_batch(count_call, NULL, 0, 100);
+    wait(); // joins the batch like any other children
+    atomic_store(&test_flag, atomic_load(&test_counter) == 100);
+}
+
+void test_go_spawn_batch_nested(void) {
+    go_shutdown();
+    go_init(1);
+    spawn(batch_children);
+    wait();
+    TEST_ASSERT_TRUE(atomic_load(&test_flag));
+}
+
+void test_go_spawn_batch_bounded(void) {
+    occupy_bounded_worker(GO_OVERFLOW_REJECT);
+    TEST_ASSERT_EQUAL(4, spawn_batch(count_call, NULL, 0, 6)); // the two past the limit are rejected
+    atomic_store(&test_flag, true);
+    wait();
+    TEST_ASSERT_EQUAL(4, atomic_load(&test_counter));
+    go_shutdown(); // the next spawn starts an unbounded pool again
+}
+
+static u64 process_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+// cpu the pool burns while the test thread sleeps right after the only worker ran out of work
+static u64 idle_cpu_ns(u64 spin_ns) {
+    go_shutdown();
+    go_init_config(&(go_config_t){.workers = 1, .spin_ns = spin_ns});
+    spawn(bump_counter);
+    wait();
+    u64 before = process_cpu_ns();
+    usleep(20 * 1000);
+    u64 used = process_cpu_ns() - before;
+    go_shutdown();
+    return used;
+}
+
+void test_go_idle_spin(void) {
+    TEST_ASSERT_TRUE(idle_cpu_ns(50 * 1000 * 1000) >= 5 * 1000 * 1000); // still spinning through the sleep
+    TEST_ASSERT_TRUE(idle_cpu_ns(GO_SPIN_OFF) < 2 * 1000 * 1000);       // parked right away
+    TEST_ASSERT_EQUAL(2, atomic_load(&test_counter));
+}
+
+static void wait_for_four(void) {
+    atomic_fetch_add(&test_counter, 1);
+    u64 give_up = clock_ns() + 1000 * 1000 * 1000ull;
+    while (atomic_load(&test_counter) < 4 && clock_ns() < give_up) {
+        usleep(100);
+    }
+}
+
+void test_go_spinner_passes_wakeups_on(void) {
+    // the spinner sees the whole burst, the four only finish once it wakes parked workers for the other three
+    go_shutdown();
+    go_init_config(&(go_config_t){.workers = 4, .spin_ns = 50 * 1000 * 1000});
+    usleep(100 * 1000); // every worker spun out and parked
+    spawn(bump_counter);
+    wait(); // leaves one worker spinning
+    atomic_store(&test_counter, 0);
+    u64 start = clock_ns();
+    for (u32 i = 0; i < 4; i++) {
+        spawn(wait_for_four);
+    }
+    wait();
+    TEST_ASSERT_TRUE(clock_ns() - start < 50 * 1000 * 1000); // not stuck behind the spinner's goroutine
+    go_shutdown();
+    go_init(0);
+}
+
+static atomic_ullong fired_ns = 0;
+
+static void mark_fired(void) { atomic_store(&fired_ns, clock_ns()); }
+
+void test_go_spawn_after(void) {
+    atomic_store(&fired_ns, 0);
+    u64 start = clock_ns();
+    spawn_after(20 * 1000 * 1000, mark_fired);
+    wait(); // an armed timer counts as spawned
+    TEST_ASSERT_TRUE(atomic_load(&fired_ns) >= start + 20 * 1000 * 1000);
+
+    // armed in reverse order of due time, all of them run
+    for (u32 i = 0; i < 1000; i++) {
+        spawn_after((1000 - i) * 10 * 1000ull, bump_counter);
+    }
+    wait();
+    TEST_ASSERT_EQUAL(1000, atomic_load(&test_counter));
+}
+
+void test_go_spawn_every(void) {
+    go_timer_t *t = spawn_every(5 * 1000 * 1000, bump_counter);
+    usleep(60 * 1000);
+    go_timer_stop(t);
+    i32 runs = atomic_load(&test_counter);
+    TEST_ASSERT_TRUE(runs >= 4 && runs <= 13);
+    usleep(20 * 1000);
+    wait();
+    TEST_ASSERT_TRUE(atomic_load(&test_counter) <= runs + 1); // one run may have been queued already
+}
+
+void test_go_timer_never_blocks(void) {
+    occupy_bounded_worker(GO_OVERFLOW_BLOCK);
+    for (u32 i = 0; i < 4; i++) {
+        spawn(bump_counter);
+    }
+    spawn_after(1000 * 1000, bump_counter);
+    u64 give_up = clock_ns() + 1000 * 1000 * 1000;
+    while (atomic_load(&test_counter) < 1 && clock_ns() < give_up) {
+        usleep(100);
+    }
+    i32 early = atomic_load(&test_counter);
+    atomic_store(&test_flag, true);
+    // ran on the timer thread while the worker was still busy and the queue full
+    TEST_ASSERT_EQUAL(1, early);
+    wait();
+    TEST_ASSERT_EQUAL(5, atomic_load(&test_counter));
+    go_shutdown();
+    go_init(0);
+}
+
+void test_go_shutdown_stops_timers(void) {
+    spawn_after(20 * 1000 * 1000, bump_counter);
+    go_timer_t *t = spawn_every(5 * 1000 * 1000, bump_counter);
+    go_shutdown();
+    usleep(40 * 1000);
+    // neither fired, and nothing restarted the pool behind the shutdown
+    TEST_ASSERT_EQUAL(0, atomic_load(&test_counter));
+    TEST_ASSERT_EQUAL(0, go_worker_count());
+    go_timer_stop(t); // the handle outlives the shutdown
+    TEST_ASSERT_EQUAL(0, go_worker_count());
+    go_init(0);
+}
+
 i32 main(void) {
     UNITY_BEGIN();
 
@@ -201,9 +733,32 @@ i32 main(void) {
     RUN_TEST(test_go_empty_block);
     RUN_TEST(test_go_variable_capture);
     RUN_TEST(test_go_race_condition_safety);
+    RUN_TEST(test_go_env_capture);
     RUN_TEST(test_go_sequential_wait_calls);
     RUN_TEST(test_go_goroutine_isolation);
     RUN_TEST(test_go_large_number_of_goroutines);
+    RUN_TEST(test_go_worker_pool_restart);
+    RUN_TEST(test_go_stats);
+    RUN_TEST(test_go_completed_survives_restart);
+    RUN_TEST(test_go_descriptor_pool_steady_state);
+    RUN_TEST(test_go_wait_inside_goroutine);
+    RUN_TEST(test_go_task_group_recursive);
+    RUN_TEST(test_go_affinity_cpuset);
+    RUN_TEST(test_go_affinity_compact);
+    RUN_TEST(test_go_priority_order);
+    RUN_TEST(test_go_priority_aging);
+    RUN_TEST(test_go_bounded_reject);
+    RUN_TEST(test_go_bounded_inline);
+    RUN_TEST(test_go_bounded_block);
+    RUN_TEST(test_go_spawn_batch);
+    RUN_TEST(test_go_spawn_batch_nested);
+    RUN_TEST(test_go_spawn_batch_bounded);
+    RUN_TEST(test_go_idle_spin);
+    RUN_TEST(test_go_spinner_passes_wakeups_on);
+    RUN_TEST(test_go_spawn_after);
+    RUN_TEST(test_go_spawn_every);
+    RUN_TEST(test_go_timer_never_blocks);
+    RUN_TEST(test_go_shutdown_stops_timers);
 
     return UNITY_END();
 }
\ No newline at end of file
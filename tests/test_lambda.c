@@ -188,6 +188,17 @@ void test_lambda_with_structs(void) {
     TEST_ASSERT_EQUAL(25, distance_squared(p1, p2)); // 3^2 + 4^2 = 9 + 16 = 25
 }
 
+static i32 add_offset(void *env, i32 x) { return *(i32 *)env + x; }
+
+void test_lambda_closure_env(void) {
+    i32 offset = 10;
+    closure_t(i32, i32) add = {add_offset, &offset};
+
+    TEST_ASSERT_EQUAL(15, closure_call(add, 5));
+    offset = 20; // the environment is referenced, not copied
+    TEST_ASSERT_EQUAL(25, closure_call(add, 5));
+}
+
 i32 main(void) {
     UNITY_BEGIN();
 
@@ -206,6 +217,7 @@ i32 main(void) {
     RUN_TEST(test_lambda_multiple_lambdas);
     RUN_TEST(test_lambda_conditional_return);
     RUN_TEST(test_lambda_with_structs);
+    RUN_TEST(test_lambda_closure_env);
 
     return UNITY_END();
 }
\ No newline at end of file
@@ -0,0 +1,177 @@
+#include "../src/go.h"
+#include "../src/pipeline.h"
+#include "../src/types.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <unity.h>
+
+#define ITEMS 1000
+
+static pipeline_t pipeline;
+static u64 values[ITEMS];
+static u32 next_value = 0;
+static u64 sink[ITEMS];
+static u32 sink_count = 0;
+static atomic_int inside = 0;
+static atomic_int max_inside = 0;
+static atomic_bool overlapped = false;
+static atomic_bool serial_violated = false;
+
+void setUp(void) {
+    next_value = 0;
+    sink_count = 0;
+    atomic_store(&inside, 0);
+    atomic_store(&max_inside, 0);
+    atomic_store(&overlapped, false);
+    atomic_store(&serial_violated, false);
+    for (u32 i = 0; i < ITEMS; i++) {
+        values[i] = i;
+    }
+}
+
+void tearDown(void) {
+    wait();
+    pipeline_destroy(&pipeline);
+}
+
+static void *source(void *item, void *env) {
+    (void)item;
+    (void)env;
+    return next_value < ITEMS ? &values[next_value++] : NULL;
+}
+
+// uneven work, so parallel stages finish out of source order
+static void *square(void *item, void *env) {
+    (void)env;
+    i32 now = atomic_fetch_add(&inside, 1) + 1;
+    i32 seen = atomic_load(&max_inside);
+    while (now > seen && !atomic_compare_exchange_weak(&max_inside, &seen, now)) {
+    }
+    u64 *v = item;
+    if (*v % 7 == 0) {
+        usleep(50);
+    }
+    *v = *v * *v;
+    atomic_fetch_sub(&inside, 1);
+    return v;
+}
+
+static void *collect(void *item, void *env) {
+    (void)env;
+    // serial stages never overlap, the unsynchronized counter below would lose items otherwise
+    if (atomic_exchange(&overlapped, true)) {
+        atomic_store(&serial_violated, true);
+    }
+    sink[sink_count++] = *(u64 *)item;
+    atomic_store(&overlapped, false);
+    return item;
+}
+
+void test_pipeline_serial_in_order(void) {
+    pipeline_init(&pipeline, 8);
+    pipeline_stage(&pipeline, PIPELINE_SERIAL_IN_ORDER, source, NULL);
+    pipeline_stage(&pipeline, PIPELINE_PARALLEL, square, NULL);
+    pipeline_stage(&pipeline, PIPELINE_SERIAL_IN_ORDER, collect, NULL);
+    pipeline_run(&pipeline);
+
+    TEST_ASSERT_EQUAL(ITEMS, sink_count);
+    for (u32 i = 0; i < ITEMS; i++) {
+        TEST_ASSERT_EQUAL(i * i, sink[i]);
+    }
+    TEST_ASSERT_FALSE(atomic_load(&serial_violated));
+    TEST_ASSERT_TRUE(atomic_load(&max_inside) <= 8); // the token limit bounds a parallel stage too
+}
+
+void test_pipeline_serial_out_of_order(void) {
+    pipeline_init(&pipeline, 16);
+    pipeline_stage(&pipeline, PIPELINE_SERIAL_OUT_OF_ORDER, source, NULL);
+    pipeline_stage(&pipeline, PIPELINE_PARALLEL, square, NULL);
+    pipeline_stage(&pipeline, PIPELINE_SERIAL_OUT_OF_ORDER, collect, NULL);
+    pipeline_run(&pipeline);
+
+    TEST_ASSERT_EQUAL(ITEMS, sink_count);
+    TEST_ASSERT_FALSE(atomic_load(&serial_violated));
+    u64 sum = 0;
+    for (u32 i = 0; i < ITEMS; i++) {
+        sum += sink[i];
+    }
+    TEST_ASSERT_EQUAL((u64)(ITEMS - 1) * ITEMS * (2 * ITEMS - 1) / 6, sum);
+}
+
+static void *drop_odd(void *item, void *env) {
+    (void)env;
+    return *(u64 *)item % 2 ? NULL : item;
+}
+
+void test_pipeline_dropped_items_keep_order(void) {
+    pipeline_init(&pipeline, 4);
+    pipeline_stage(&pipeline, PIPELINE_SERIAL_IN_ORDER, source, NULL);
+    pipeline_stage(&pipeline, PIPELINE_PARALLEL, drop_odd, NULL);
+    pipeline_stage(&pipeline, PIPELINE_PARALLEL, square, NULL);
+    pipeline_stage(&pipeline, PIPELINE_SERIAL_IN_ORDER, collect, NULL);
+    pipeline_run(&pipeline);
+
+    TEST_ASSERT_EQUAL(ITEMS / 2, sink_count);
+    for (u32 i = 0; i < ITEMS / 2; i++) {
+        TEST_ASSERT_EQUAL(4 * i * i, sink[i]);
+    }
+}
+
+static void run_inner_pipeline(void) {
+    pipeline_run(&pipeline); // from inside a goroutine, helps instead of blocking the worker
+}
+
+void test_pipeline_rerun_nested(void) {
+    go_shutdown();
+    go_init(1);
+    pipeline_init(&pipeline, 2);
+    pipeline_stage(&pipeline, PIPELINE_SERIAL_IN_ORDER, source, NULL);
+    pipeline_stage(&pipeline, PIPELINE_SERIAL_IN_ORDER, collect, NULL);
+    pipeline_run(&pipeline);
+    TEST_ASSERT_EQUAL(ITEMS, sink_count);
+
+    next_value = 0;
+    sink_count = 0;
+    spawn(run_inner_pipeline);
+    wait();
+    TEST_ASSERT_EQUAL(ITEMS, sink_count);
+    for (u32 i = 0; i < ITEMS; i++) {
+        TEST_ASSERT_EQUAL(i, sink[i]);
+    }
+}
+
+void test_pipeline_rejecting_pool(void) {
+    // room for a single queued token, the rest are rejected and carried on by the thread that released them
+    go_shutdown();
+    go_init_config(&(go_config_t){.workers = 2, .queue_limit = 1, .overflow = GO_OVERFLOW_REJECT});
+    pipeline_init(&pipeline, 8);
+    pipeline_stage(&pipeline, PIPELINE_SERIAL_IN_ORDER, source, NULL);
+    pipeline_stage(&pipeline, PIPELINE_PARALLEL, square, NULL);
+    pipeline_stage(&pipeline, PIPELINE_SERIAL_IN_ORDER, collect, NULL);
+    pipeline_run(&pipeline);
+
+    TEST_ASSERT_EQUAL(ITEMS, sink_count);
+    for (u32 i = 0; i < ITEMS; i++) {
+        TEST_ASSERT_EQUAL(i * i, sink[i]);
+    }
+    TEST_ASSERT_FALSE(atomic_load(&serial_violated));
+    go_stats_t stats;
+    go_stats(&stats);
+    TEST_ASSERT_TRUE(stats.rejected > 0);
+    go_shutdown();
+    go_init(0);
+}
+
+i32 main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_pipeline_serial_in_order);
+    RUN_TEST(test_pipeline_serial_out_of_order);
+    RUN_TEST(test_pipeline_dropped_items_keep_order);
+    RUN_TEST(test_pipeline_rerun_nested);
+    RUN_TEST(test_pipeline_rejecting_pool);
+
+    return UNITY_END();
+}
@@ -0,0 +1,163 @@
+#include "../src/go.h"
+#include "../src/taskgraph.h"
+#include "../src/types.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <unity.h>
+
+static taskgraph_t graph;
+static atomic_int order[16];
+static atomic_int order_index = 0;
+static atomic_bool other_branch_ran = false;
+
+void setUp(void) {
+    taskgraph_init(&graph);
+    atomic_store(&order_index, 0);
+    atomic_store(&other_branch_ran, false);
+}
+
+void tearDown(void) {
+    wait();
+    taskgraph_destroy(&graph);
+}
+
+typedef struct {
+    i32 id;
+} step_env_t;
+
+static void step(void *arg) {
+    step_env_t *env = arg;
+    usleep(200);
+    atomic_store(&order[atomic_fetch_add(&order_index, 1)], env->id);
+}
+
+static i32 position(i32 id) {
+    for (i32 i = 0; i < atomic_load(&order_index); i++) {
+        if (atomic_load(&order[i]) == id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void test_taskgraph_diamond(void) {
+    // diamond: 0 before 1 and 2, both before 3
+    u32 n[4];
+    for (i32 i = 0; i < 4; i++) {
+        n[i] = taskgraph_node_go_env(&graph, step, (step_env_t){.id = i});
+    }
+    taskgraph_edge(&graph, n[0], n[1]);
+    taskgraph_edge(&graph, n[0], n[2]);
+    taskgraph_edge(&graph, n[1], n[3]);
+    taskgraph_edge(&graph, n[2], n[3]);
+
+    taskgraph_run(&graph);
+    TEST_ASSERT_EQUAL(4, atomic_load(&order_index));
+    TEST_ASSERT_EQUAL(0, position(0));
+    TEST_ASSERT_EQUAL(3, position(3));
+}
+
+void test_taskgraph_reuse_without_allocation(void) {
+    // a single worker, so the first run warms every pool the later runs take descriptors from
+    go_shutdown();
+    go_init(1);
+    u32 previous = taskgraph_node_go_env(&graph, step, (step_env_t){.id = 0});
+    for (i32 i = 1; i < 8; i++) {
+        u32 next = taskgraph_node_go_env(&graph, step, (step_env_t){.id = i});
+        taskgraph_edge(&graph, previous, next);
+        previous = next;
+    }
+    taskgraph_run(&graph); // warms the descriptor pools
+    taskgraph_node_t *nodes = graph.nodes;
+    go_stats_t before, after;
+    go_stats(&before);
+
+    for (u32 run = 0; run < 20; run++) {
+        atomic_store(&order_index, 0);
+        taskgraph_run(&graph);
+        TEST_ASSERT_EQUAL(8, atomic_load(&order_index));
+        for (i32 i = 0; i < 8; i++) {
+            TEST_ASSERT_EQUAL(i, atomic_load(&order[i]));
+        }
+    }
+    go_stats(&after);
+    TEST_ASSERT_TRUE(nodes == graph.nodes);
+    TEST_ASSERT_EQUAL(before.descriptors_allocated, after.descriptors_allocated);
+}
+
+static void wait_for_other_branch(void) {
+    // only finishes if the other chain makes progress while this node is still running
+    for (u32 i = 0; i < 10000 && !atomic_load(&other_branch_ran); i++) {
+        usleep(100);
+    }
+}
+
+static void mark_other_branch(void) { atomic_store(&other_branch_ran, true); }
+
+static void noop(void) {}
+
+void test_taskgraph_branches_overlap(void) {
+    go_shutdown();
+    go_init(2);
+    // a -> slow, b -> c -> mark: no barrier between the chains, so mark runs while slow is still waiting
+    u32 a = taskgraph_node(&graph, noop);
+    u32 slow = taskgraph_node(&graph, wait_for_other_branch);
+    u32 b = taskgraph_node(&graph, noop);
+    u32 c = taskgraph_node(&graph, noop);
+    u32 mark = taskgraph_node(&graph, mark_other_branch);
+    taskgraph_edge(&graph, a, slow);
+    taskgraph_edge(&graph, b, c);
+    taskgraph_edge(&graph, c, mark);
+
+    taskgraph_run(&graph);
+    TEST_ASSERT_TRUE(atomic_load(&other_branch_ran));
+}
+
+static void run_inner_graph(void) {
+    taskgraph_t inner;
+    taskgraph_init(&inner);
+    u32 first = taskgraph_node_go_env(&inner, step, (step_env_t){.id = 1});
+    u32 second = taskgraph_node_go_env(&inner, step, (step_env_t){.id = 2});
+    taskgraph_edge(&inner, first, second);
+    taskgraph_run(&inner); // from inside a goroutine, helps instead of blocking the worker
+    taskgraph_destroy(&inner);
+}
+
+void test_taskgraph_nested_run(void) {
+    go_shutdown();
+    go_init(1);
+    u32 outer = taskgraph_node(&graph, run_inner_graph);
+    u32 last = taskgraph_node_go_env(&graph, step, (step_env_t){.id = 3});
+    taskgraph_edge(&graph, outer, last);
+    taskgraph_run(&graph);
+    TEST_ASSERT_EQUAL(3, atomic_load(&order_index));
+    TEST_ASSERT_EQUAL(2, position(3));
+}
+
+void test_taskgraph_rejecting_pool(void) {
+    // room for a single queued node, the rest are rejected and run on the thread that releases them
+    go_shutdown();
+    go_init_config(&(go_config_t){.workers = 1, .queue_limit = 1, .overflow = GO_OVERFLOW_REJECT});
+    u32 sink = taskgraph_node_go_env(&graph, step, (step_env_t){.id = 8});
+    for (i32 i = 0; i < 8; i++) {
+        taskgraph_edge(&graph, taskgraph_node_go_env(&graph, step, (step_env_t){.id = i}), sink);
+    }
+    taskgraph_run(&graph);
+    TEST_ASSERT_EQUAL(9, atomic_load(&order_index));
+    TEST_ASSERT_EQUAL(8, position(8));
+    go_shutdown();
+    go_init(0);
+}
+
+i32 main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_taskgraph_diamond);
+    RUN_TEST(test_taskgraph_reuse_without_allocation);
+    RUN_TEST(test_taskgraph_branches_overlap);
+    RUN_TEST(test_taskgraph_nested_run);
+    RUN_TEST(test_taskgraph_rejecting_pool);
+
+    return UNITY_END();
+}
@@ -0,0 +1,143 @@
+#include "../src/go.h"
+#include "../src/tqdm.h"
+#include "../src/types.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <unity.h>
+
+static char path[32];
+static i32 fd = -1;
+static tqdm_bar_t *shared = NULL;
+
+void setUp(void) {
+    strcpy(path, "/tmp/sheaf_tqdm_XXXXXX");
+    fd = mkstemp(path);
+    TEST_ASSERT_TRUE(fd >= 0);
+    tqdm_output(fd);
+}
+
+void tearDown(void) {
+    tqdm_output(STDOUT_FILENO);
+    close(fd);
+    unlink(path);
+}
+
+static char *read_output(void) {
+    i64 size = lseek(fd, 0, SEEK_END);
+    char *buffer = calloc(1, (size_t)size + 1);
+    TEST_ASSERT_NOT_NULL(buffer);
+    TEST_ASSERT_EQUAL(size, pread(fd, buffer, (size_t)size, 0));
+    return buffer;
+}
+
+static u32 count_occurrences(const char *haystack, const char *needle) {
+    u32 count = 0;
+    for (const char *p = strstr(haystack, needle); p; p = strstr(p + 1, needle)) {
+        count++;
+    }
+    return count;
+}
+
+static void update_many(void) {
+    for (u32 i = 0; i < 1000; i++) {
+        tqdm_update(shared, 1);
+    }
+}
+
+void test_tqdm_concurrent_updates(void) {
+    shared = tqdm_open(64000, "work", "items");
+    for (u32 i = 0; i < 64; i++) {
+        spawn(update_many);
+    }
+    wait();
+    TEST_ASSERT_EQUAL(64000, atomic_load(&shared->current));
+    tqdm_close(shared);
+
+    char *out = read_output();
+    TEST_ASSERT_NOT_NULL(strstr(out, "work: 100%|"));
+    TEST_ASSERT_NOT_NULL(strstr(out, "| 64000/64000 ["));
+    TEST_ASSERT_NOT_NULL(strstr(out, "items"));
+    TEST_ASSERT_EQUAL('\n', out[strlen(out) - 1]);
+    free(out);
+}
+
+static void sleepy(void) { usleep(1000); }
+
+void test_tqdm_polled_by_runtime(void) {
+    go({ sleepy(); });
+    wait();
+    // counts from the moment the bar opens, earlier goroutines don't show up
+    tqdm_bar_t *bar = tqdm_open_polled(50, "polled", "tasks", go_completed);
+    for (u32 i = 0; i < 50; i++) {
+        spawn(sleepy);
+    }
+    wait();
+    tqdm_close(bar);
+
+    char *out = read_output();
+    TEST_ASSERT_NOT_NULL(strstr(out, "polled:   0%|"));
+    TEST_ASSERT_NOT_NULL(strstr(out, "polled: 100%|"));
+    TEST_ASSERT_NOT_NULL(strstr(out, "| 50/50 ["));
+    TEST_ASSERT_NULL(strstr(out, "51/50"));
+    free(out);
+}
+
+void test_tqdm_rate_limited(void) {
+    tqdm_bar_t *bar = tqdm_open(1000, "fast", NULL);
+    for (u32 i = 0; i < 1000; i++) {
+        tqdm_update(bar, 1);
+        tqdm_render();
+    }
+    tqdm_close(bar);
+
+    // the forced draws on open and close, plus at most a few timed ones in between
+    char *out = read_output();
+    TEST_ASSERT_TRUE(count_occurrences(out, "\r") <= 5);
+    TEST_ASSERT_NOT_NULL(strstr(out, "1000/1000"));
+    free(out);
+}
+
+void test_tqdm_stacked_bars(void) {
+    tqdm_bar_t *outer = tqdm_open(2, "outer", NULL);
+    tqdm_bar_t *inner = tqdm_open(3, "inner", NULL);
+    tqdm_update(inner, 3);
+    tqdm_close(inner);
+    tqdm_update(outer, 2);
+    tqdm_close(outer);
+
+    char *out = read_output();
+    // the inner bar finished first, so its final line lands above the outer one
+    char *inner_final = strstr(out, "inner: 100%");
+    char *outer_final = strstr(out, "outer: 100%");
+    TEST_ASSERT_NOT_NULL(inner_final);
+    TEST_ASSERT_NOT_NULL(outer_final);
+    TEST_ASSERT_TRUE(inner_final < outer_final);
+    // while both were open the live area was two lines, redraws move back up to its top
+    TEST_ASSERT_NOT_NULL(strstr(out, "\x1b[1A"));
+    free(out);
+}
+
+void test_tqdm_single_bar_api(void) {
+    for (u64 i = 0; i <= 10; i++) {
+        tqdm(i, 10, "legacy", "steps");
+    }
+    char *out = read_output();
+    TEST_ASSERT_NOT_NULL(strstr(out, "legacy: 100%"));
+    TEST_ASSERT_NOT_NULL(strstr(out, "10/10"));
+    free(out);
+}
+
+i32 main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_tqdm_concurrent_updates);
+    RUN_TEST(test_tqdm_polled_by_runtime);
+    RUN_TEST(test_tqdm_rate_limited);
+    RUN_TEST(test_tqdm_stacked_bars);
+    RUN_TEST(test_tqdm_single_bar_api);
+
+    return UNITY_END();
+}
@@ -0,0 +1,142 @@
+#include "../src/async.h"
+#include "../src/go.h"
+#include "../src/trace.h"
+#include "../src/types.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <unity.h>
+
+static atomic_int test_counter = 0;
+static char path[32];
+
+void setUp(void) { atomic_store(&test_counter, 0); }
+
+void tearDown(void) {
+    trace_stop();
+    wait();
+    async_cleanup_all();
+}
+
+static void yield_task(void) {
+    atomic_fetch_add(&test_counter, 1);
+    async_yield();
+    atomic_fetch_add(&test_counter, 1);
+}
+
+static u32 count_occurrences(const char *haystack, const char *needle) {
+    u32 count = 0;
+    for (const char *p = strstr(haystack, needle); p; p = strstr(p + 1, needle)) {
+        count++;
+    }
+    return count;
+}
+
+static void make_path(void) {
+    strcpy(path, "/tmp/sheaf_trace_XXXXXX");
+    i32 fd = mkstemp(path);
+    TEST_ASSERT_TRUE(fd >= 0);
+    close(fd);
+}
+
+static char *read_file(const char *name) {
+    FILE *f = fopen(name, "r");
+    TEST_ASSERT_NOT_NULL(f);
+    fseek(f, 0, SEEK_END);
+    i64 size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *buffer = calloc(1, (size_t)size + 1);
+    TEST_ASSERT_NOT_NULL(buffer);
+    TEST_ASSERT_EQUAL(size, fread(buffer, 1, (size_t)size, f));
+    fclose(f);
+    return buffer;
+}
+
+void test_trace_lifecycle_events(void) {
+    make_path();
+
+    bool started = trace_start(path);
+#ifdef SHEAF_TRACE
+    TEST_ASSERT_TRUE(started);
+    TEST_ASSERT_FALSE(trace_start(path));
+#else
+    TEST_ASSERT_FALSE(started);
+#endif
+
+    for (i32 i = 0; i < 4; i++) {
+        go({ atomic_fetch_add(&test_counter, 1); });
+    }
+    wait();
+    async_spawn(yield_task);
+    async_run_all();
+    trace_stop();
+    TEST_ASSERT_EQUAL(6, atomic_load(&test_counter));
+
+    char *json = read_file(path);
+#ifdef SHEAF_TRACE
+    TEST_ASSERT_NOT_NULL(strstr(json, "\"traceEvents\""));
+    // 4 goroutines + one coroutine started and resumed once
+    TEST_ASSERT_EQUAL(6, count_occurrences(json, "\"ph\":\"B\""));
+    TEST_ASSERT_EQUAL(6, count_occurrences(json, "\"ph\":\"E\""));
+    TEST_ASSERT_EQUAL(5, count_occurrences(json, "\"ph\":\"s\""));
+    TEST_ASSERT_EQUAL(1, count_occurrences(json, "\"event\":\"yield\""));
+    TEST_ASSERT_EQUAL(1, count_occurrences(json, "\"event\":\"resume\""));
+#else
+    TEST_ASSERT_EQUAL(0, strlen(json));
+#endif
+    free(json);
+    unlink(path);
+}
+
+void test_trace_inactive_records_nothing(void) {
+    make_path();
+
+    go({ atomic_fetch_add(&test_counter, 1); });
+    wait();
+
+    trace_start(path);
+    trace_stop();
+
+    char *json = read_file(path);
+    TEST_ASSERT_EQUAL(0, count_occurrences(json, "\"ph\":\"B\""));
+    free(json);
+    unlink(path);
+}
+
+void test_trace_wrapped_ring_pairs_slices(void) {
+    make_path();
+    trace_start(path);
+    // a slice around a whole ring's worth of events: its B is overwritten by the wrap, and so is the B of
+    // the oldest E that is still in the ring
+    trace_record(TRACE_START, TRACE_GO, 1);
+    for (u64 i = 0; i < TRACE_RING_EVENTS; i++) {
+        trace_record(TRACE_START, TRACE_GO, i + 2);
+        trace_record(TRACE_FINISH, TRACE_GO, i + 2);
+    }
+    trace_record(TRACE_FINISH, TRACE_GO, 1);
+    trace_stop();
+
+    char *json = read_file(path);
+#ifdef SHEAF_TRACE
+    u32 begins = count_occurrences(json, "\"ph\":\"B\"");
+    TEST_ASSERT_TRUE(begins > 0);
+    TEST_ASSERT_EQUAL(begins, count_occurrences(json, "\"ph\":\"E\""));
+#else
+    TEST_ASSERT_EQUAL(0, strlen(json));
+#endif
+    free(json);
+    unlink(path);
+}
+
+i32 main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_trace_lifecycle_events);
+    RUN_TEST(test_trace_inactive_records_nothing);
+    RUN_TEST(test_trace_wrapped_ring_pairs_slices);
+
+    return UNITY_END();
+}